@@ -26,6 +26,11 @@ TSYS=linux
 OUT=insaniquant
 #
 #
+# Name of the kernel microbenchmark executable (make bench).
+#
+BOUT=insaniquant-bench
+#
+#
 # A few paths in case they would be necessary. Leave them alone unless
 # it is necessary to modify.
 #
@@ -44,3 +49,10 @@ CC=gcc
 # symbols enabled.
 #
 GO=
+#
+#
+# To compile in the run statistics (stage timings, call counters and such,
+# output by the --stats option), give 'yes' here. Without it the
+# instrumentation produces no code.
+#
+STATS=
@@ -46,6 +46,13 @@ CFLAGS+= -DTARGET_DEBUG
 endif
 #
 #
+# When asking for run statistics
+#
+ifeq ($(STATS),yes)
+CFLAGS+= -DTARGET_STATS
+endif
+#
+#
 # 'Production' edit
 #
 CFSPD?=-O2 -s
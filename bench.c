@@ -0,0 +1,332 @@
+/**
+**  \file
+**  \brief     InsaniQuant kernel microbenchmarks
+**  \author    Sandor Zsuga (Jubatian)
+**  \copyright 2013 - 2017, GNU General Public License version 2 or any later
+**             version, see LICENSE
+**  \date      2017.03.31
+**
+**
+** This program is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 2 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+**
+**
+** Standalone program timing the innermost routines of the quantizer over a
+** few typical color distributions. Variants of a kernel (table driven, SIMD
+** and such) are listed after their scalar reference, and are compared to it.
+**
+** Short usage summary:
+** insaniquant-bench [min. seconds per kernel]
+*/
+
+
+
+#include "types.h"
+#include "version.h"
+#include "itime.h"
+#include "idata.h"
+#include "coldiff.h"
+#include "coldepth.h"
+#include "palgen.h"
+
+
+
+/* Count of samples in a distribution */
+#define BENCH_SAMP 65536U
+
+/* Count of distributions */
+#define BENCH_DIST 3U
+
+/* Sample colors (24 bit RGB) of the current distribution */
+static auint bench_src[BENCH_SAMP];
+
+/* Precalculated features of the samples for coldiff_hsl() */
+static auint bench_fhs[BENCH_SAMP];
+static auint bench_flm[BENCH_SAMP];
+
+/* Packed RGB image buffer made of the samples */
+static uint8 bench_img[BENCH_SAMP * 3U];
+
+/* Image plane for unpacking into */
+static auint bench_pln[BENCH_SAMP];
+
+/* Palette buffer for palgen */
+static iquant_col_t bench_pcb[BENCH_SAMP];
+
+/* Result sink, so the compiler can not optimize out the kernels */
+static volatile auint bench_snk;
+
+/* Distribution names */
+static char const* const bench_dnam[BENCH_DIST] = {
+ "random",
+ "low-entropy",
+ "greyscale"};
+
+/* Random number generator state */
+static auint bench_rst;
+
+
+
+/* Returns a pseudo-random number (0 - 0xFFFFFF) */
+static auint bench_rand(void)
+{
+ bench_rst = (bench_rst * 1103515245U) + 12345U;
+ return (bench_rst >> 8) & 0xFFFFFFU;
+}
+
+
+
+/* Clips a color component with noise added */
+static auint bench_clip(auint c, auint n)
+{
+ asint v = (asint)(c) + (asint)(n & 0x7U) - 3;
+ if (v <   0){ v =   0; }
+ if (v > 255){ v = 255; }
+ return (auint)(v);
+}
+
+
+
+/* Generates the samples of a distribution. 0: Uniform random colors, 1: Low
+** entropy (a few base colors with mild noise, as in typical flat shaded
+** art), 2: Greyscale. */
+static void bench_gen(auint dist)
+{
+ auint bas[12];
+ auint i;
+ auint c;
+ auint n;
+
+ bench_rst = 0x5A5AU + dist;
+ for (i = 0U; i < 12U; i++){ bas[i] = bench_rand(); }
+
+ for (i = 0U; i < BENCH_SAMP; i++){
+  c = bench_rand();
+  if       (dist == 1U){
+   n = bench_rand();
+   c = bas[c % 12U];
+   c = (bench_clip((c >> 16) & 0xFFU, n      ) << 16) |
+       (bench_clip((c >>  8) & 0xFFU, n >>  3) <<  8) |
+       (bench_clip((c      ) & 0xFFU, n >>  6)      );
+  }else if (dist == 2U){
+   c = c & 0xFFU;
+   c = c | (c << 8) | (c << 16);
+  }
+  bench_src[i] = c;
+  bench_fhs[i] = coldiff_hs(c);
+  bench_flm[i] = coldiff_getlum(c);
+ }
+ idata_pack(bench_src, bench_img, BENCH_SAMP);
+}
+
+
+
+/* Kernels. Each processes all the samples once, and returns the count of
+** kernel calls made. */
+
+static auint bench_k_coldiff(void)
+{
+ auint i;
+ auint r = 0U;
+ for (i = 1U; i < BENCH_SAMP; i++){
+  r += coldiff(bench_src[i - 1U], bench_src[i]);
+ }
+ bench_snk = r;
+ return BENCH_SAMP - 1U;
+}
+
+static auint bench_k_coldiff_hsl(void)
+{
+ auint i;
+ auint r = 0U;
+ for (i = 1U; i < BENCH_SAMP; i++){
+  r += coldiff_hsl(bench_src[i - 1U], bench_fhs[i - 1U], bench_flm[i - 1U],
+                   bench_src[i], bench_fhs[i], bench_flm[i]);
+ }
+ bench_snk = r;
+ return BENCH_SAMP - 1U;
+}
+
+static auint bench_k_huesat(void)
+{
+ auint i;
+ auint h;
+ auint s;
+ auint r = 0U;
+ for (i = 0U; i < BENCH_SAMP; i++){
+  coldiff_huesat(bench_src[i], &h, &s);
+  r += h + s;
+ }
+ bench_snk = r;
+ return BENCH_SAMP;
+}
+
+static auint bench_k_coldepth(void)
+{
+ auint i;
+ auint r = 0U;
+ for (i = 0U; i < BENCH_SAMP; i++){
+  r += coldepth(bench_src[i], 0x444U);
+ }
+ bench_snk = r;
+ return BENCH_SAMP;
+}
+
+static auint bench_k_coldepth_ds444(void)
+{
+ auint i;
+ auint r = 0U;
+ for (i = 0U; i < BENCH_SAMP; i++){
+  r += coldepth_ds(bench_src[i], 0x444U);
+ }
+ bench_snk = r;
+ return BENCH_SAMP;
+}
+
+static auint bench_k_coldepth_d444(void)
+{
+ auint i;
+ auint r = 0U;
+ for (i = 0U; i < BENCH_SAMP; i++){
+  r += coldepth_d(bench_src[i], 0x444U);
+ }
+ bench_snk = r;
+ return BENCH_SAMP;
+}
+
+static auint bench_k_coldepth_ds332(void)
+{
+ auint i;
+ auint r = 0U;
+ for (i = 0U; i < BENCH_SAMP; i++){
+  r += coldepth_ds(bench_src[i], 0x332U);
+ }
+ bench_snk = r;
+ return BENCH_SAMP;
+}
+
+static auint bench_k_coldepth_d332(void)
+{
+ auint i;
+ auint r = 0U;
+ for (i = 0U; i < BENCH_SAMP; i++){
+  r += coldepth_d(bench_src[i], 0x332U);
+ }
+ bench_snk = r;
+ return BENCH_SAMP;
+}
+
+static auint bench_k_idata_unpack(void)
+{
+ idata_unpack(bench_img, bench_pln, BENCH_SAMP);
+ bench_snk = bench_pln[BENCH_SAMP - 1U];
+ return BENCH_SAMP;
+}
+
+static auint bench_k_idata_pack(void)
+{
+ idata_pack(bench_src, bench_img, BENCH_SAMP);
+ bench_snk = bench_img[0];
+ return BENCH_SAMP;
+}
+
+static auint bench_k_palgen(void)
+{
+ iquant_pal_t pal;
+ pal.col = &(bench_pcb[0]);
+ pal.mct = BENCH_SAMP;
+ palgen(bench_src, BENCH_SAMP, &pal, 3U);
+ bench_snk = pal.cct;
+ return BENCH_SAMP;
+}
+
+
+
+/* Kernel table. The reference member gives the index of the scalar
+** reference kernel if the entry is a variant of it, or the entry's own index
+** if it is a reference. */
+typedef struct{
+ char const* nam;       /* Name of the kernel */
+ auint     (*fun)(void);/* Kernel function */
+ auint       ref;       /* Reference kernel's index */
+}bench_kern_t;
+
+static const bench_kern_t bench_kern[] = {
+ {"coldiff",         &bench_k_coldiff,        0U},
+ {"coldiff_hsl",     &bench_k_coldiff_hsl,    0U},
+ {"coldiff_huesat",  &bench_k_huesat,         2U},
+ {"coldepth 444",    &bench_k_coldepth,       3U},
+ {"coldepth_ds 444", &bench_k_coldepth_ds444, 4U},
+ {"coldepth_d 444",  &bench_k_coldepth_d444,  4U},
+ {"coldepth_ds 332", &bench_k_coldepth_ds332, 6U},
+ {"coldepth_d 332",  &bench_k_coldepth_d332,  6U},
+ {"idata_unpack",    &bench_k_idata_unpack,   8U},
+ {"idata_pack",      &bench_k_idata_pack,     9U},
+ {"palgen (px) 333", &bench_k_palgen,        10U}};
+
+#define BENCH_KCNT (sizeof(bench_kern) / sizeof(bench_kern[0]))
+
+
+
+/* Main */
+
+int main(int argc, char** argv)
+{
+ double mtm = 0.25;
+ double tst;
+ double tel;
+ double nsc[BENCH_KCNT];
+ auint  cnt;
+ auint  d;
+ auint  k;
+
+ if (argc > 1){ mtm = atof(argv[1]); }
+ if (mtm <= 0.0){ mtm = 0.25; }
+
+ printf("InsaniQuant kernel benchmark, Version: %s\n", IQUANT_VERSION);
+ printf("Samples: %u, minimal time per kernel: %.2f s\n\n", BENCH_SAMP, mtm);
+ printf("%-16s %-12s %12s %12s %8s\n", "Kernel", "Distribution", "ns/call", "Mcalls/s", "Speedup");
+
+ for (d = 0U; d < BENCH_DIST; d++){
+
+  bench_gen(d);
+
+  for (k = 0U; k < BENCH_KCNT; k++){
+
+   (void)(bench_kern[k].fun()); /* Warm up (also initializes tables) */
+
+   cnt = 0U;
+   tst = itime_get();
+   do{
+    cnt += bench_kern[k].fun();
+    tel = itime_get() - tst;
+   }while (tel < mtm);
+
+   nsc[k] = (tel * 1.0e9) / (double)(cnt);
+
+   printf("%-16s %-12s %12.2f %12.3f ",
+          bench_kern[k].nam, bench_dnam[d], nsc[k], 1.0e3 / nsc[k]);
+   if (bench_kern[k].ref != k){
+    printf("%7.2fx\n", nsc[bench_kern[k].ref] / nsc[k]);
+   }else{
+    printf("%8s\n", "ref");
+   }
+
+  }
+
+  printf("\n");
+
+ }
+
+ return 0;
+}
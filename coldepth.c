@@ -24,6 +24,7 @@
 
 #include "coldepth.h"
 #include "coldiff.h"
+#include "istat.h"
 
 
 /* Internal depth reduction tables for each depth */
@@ -34,6 +35,15 @@ static uint8 coldepth_le[256U * 8U];
 /* Whether the table was initialized already */
 static auint coldepth_ti = 0U;
 
+/* Nearest color cache size (power of 2) */
+#define COLDEPTH_CSIZ 8192U
+
+/* Nearest color cache: source colors, depths (zero: empty slot) and the
+** nearest colors. Direct mapped by a hash of the color and depth. */
+static auint coldepth_cc[COLDEPTH_CSIZ];
+static auint coldepth_cd[COLDEPTH_CSIZ];
+static auint coldepth_cn[COLDEPTH_CSIZ];
+
 
 
 /* Table initializer function */
@@ -136,8 +146,33 @@ static auint coldepth_ccom(auint r, auint g, auint b)
 
 
 /* Returns the nearest color of the given depth to the passed one by
-** difference (as from coldiff). */
+** difference (as from coldiff). Results are cached, so repeated requests
+** for the same color and depth are a single lookup. */
 auint coldepth_d(auint col, auint dep)
+{
+ auint h;
+
+ ISTAT_INC(ISTAT_COLDEPTH_D);
+
+ if (dep <= 8U){ dep = (dep) | (dep << 4) | (dep << 8); }
+ if (dep == 0x888U){ return col; }
+
+ h = ((col ^ (dep << 12)) * 2654435761U) >> 19; /* 13 bits: cache size */
+
+ if ((coldepth_cc[h] != col) || (coldepth_cd[h] != dep)){
+  coldepth_cc[h] = col;
+  coldepth_cd[h] = dep;
+  coldepth_cn[h] = coldepth_ds(col, dep);
+ }
+
+ return coldepth_cn[h];
+}
+
+
+
+/* Returns the nearest color of the given depth to the passed one by
+** difference, always searching (the uncached coldepth_d()). */
+auint coldepth_ds(auint col, auint dep)
 {
  auint r;
  auint g;
@@ -150,6 +185,8 @@ auint coldepth_d(auint col, auint dep)
  auint gdep;
  auint bdep;
 
+ ISTAT_INC(ISTAT_COLDEPTH_M);
+
  if (dep <= 8U){ dep = (dep) | (dep << 4) | (dep << 8); }
  if (dep == 0x888U){ return col; }
 
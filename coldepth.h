@@ -36,8 +36,14 @@ auint coldepth(auint col, auint dep);
 
 
 /* Returns the nearest color of the given depth to the passed one by
-** difference (as from coldiff). */
+** difference (as from coldiff). Results are cached, so repeated requests
+** for the same color and depth are a single lookup. */
 auint coldepth_d(auint col, auint dep);
 
 
+/* Returns the nearest color of the given depth to the passed one by
+** difference, always searching (the uncached coldepth_d()). */
+auint coldepth_ds(auint col, auint dep);
+
+
 #endif
@@ -24,6 +24,7 @@
 
 #include "types.h"
 #include "coldiff.h"
+#include "istat.h"
 
 
 
@@ -139,7 +140,7 @@ static void coldiff_tb_init(void)
 ** 0xEA - 0x00: Purple <-> Red (Not too visible difference)
 ** The saturation comes from the greatest difference along components, which
 ** is used for the Hue calculation as well. */
-static void coldiff_huesat(auint c, auint* h, auint* s)
+void coldiff_huesat(auint c, auint* h, auint* s)
 {
  auint r, g, b;
  auint d;
@@ -201,32 +202,32 @@ auint coldiff_getlum(auint c0)
 
 
 
-/* Normal color difference calculation between two RGB colors. Returns a
-** difference value between 0 and 4096. */
-auint coldiff(auint c0, auint c1)
+/* Returns the hue and saturation of the color packed (hue in the low 8
+** bits, saturation in the next 8 bits), for coldiff_hsl(). */
+auint coldiff_hs(auint c)
 {
- auint h0;
- auint s0;
- auint h1;
- auint s1;
- auint g0;
- auint g1;
- auint r;
- auint t;
+ auint h;
+ auint s;
 
- /* Shortcut when comparing identical colors */
+ coldiff_huesat(c, &h, &s);
 
- if (((c0 ^ c1) & 0xFFFFFFU) == 0U){ return 0U; }
+ return h | (s << 8);
+}
 
- /* Hue / Saturation difference */
 
- coldiff_huesat(c0, &h0, &s0);
- coldiff_huesat(c1, &h1, &s1);
 
- g0 = (h0 - h1) & 0xFFU;       /* Hues - circular difference is needed */
- g1 = (h1 - h0) & 0xFFU;       /* (Maximal diff. is 128 for this) */
- if (g0 < g1){ r = g0; }
- else        { r = g1; }
+/* Difference calculation from the hue, saturation and luminosity of the two
+** colors. */
+static auint coldiff_calc(auint h0, auint s0, auint g0, auint h1, auint s1, auint g1)
+{
+ auint r;
+ auint t;
+
+ /* Hue / Saturation difference */
+
+ t  = (h0 - h1) & 0xFFU;       /* Hues - circular difference is needed */
+ r  = (h1 - h0) & 0xFFU;       /* (Maximal diff. is 128 for this) */
+ if (t < r){ r = t; }
  if (s0 < s1){
   t = s1 - s0;                 /* Saturation difference (0 - 255) */
   r = r * s0;
@@ -239,10 +240,66 @@ auint coldiff(auint c0, auint c1)
 
  /* Greyscale difference */
 
- g0 = coldiff_getlum(c0);
- g1 = coldiff_getlum(c1);
  t = abs((asint)(g0) - (asint)(g1));
  r += (t * LUM_DIFF) >> 8;     /* Luminosity difference (0 - 65536) */
 
  return (r >> 6);
 }
+
+
+
+/* Color difference calculation like coldiff(), from precalculated features
+** of the colors: hue and saturation from coldiff_hs(), and luminosity from
+** coldiff_getlum(). Gives the same result as coldiff(), faster when the same
+** colors are compared a lot. */
+auint coldiff_hsl(auint c0, auint hs0, auint l0, auint c1, auint hs1, auint l1)
+{
+ ISTAT_INC(ISTAT_COLDIFF);
+
+ if (((c0 ^ c1) & 0xFFFFFFU) == 0U){ return 0U; }
+
+ return coldiff_calc(hs0 & 0xFFU, hs0 >> 8, l0, hs1 & 0xFFU, hs1 >> 8, l1);
+}
+
+
+
+/* Returns a lower bound of the color difference of two colors, from their
+** saturation and luminosity only (features as for coldiff_hsl()). Cheaper
+** than the difference, for skipping colors which can not be near enough. */
+auint coldiff_lb(auint hs0, auint l0, auint hs1, auint l1)
+{
+ auint s0 = hs0 >> 8;
+ auint s1 = hs1 >> 8;
+ auint r;
+
+ if (s0 < s1){ r = s1 - s0; }
+ else        { r = s0 - s1; }
+ r *= SAT_DIFF;
+ if (l0 < l1){ r += ((l1 - l0) * LUM_DIFF) >> 8; }
+ else        { r += ((l0 - l1) * LUM_DIFF) >> 8; }
+
+ return (r >> 6);
+}
+
+
+
+/* Normal color difference calculation between two RGB colors. Returns a
+** difference value between 0 and 4096. */
+auint coldiff(auint c0, auint c1)
+{
+ auint h0;
+ auint s0;
+ auint h1;
+ auint s1;
+
+ ISTAT_INC(ISTAT_COLDIFF);
+
+ /* Shortcut when comparing identical colors */
+
+ if (((c0 ^ c1) & 0xFFFFFFU) == 0U){ return 0U; }
+
+ coldiff_huesat(c0, &h0, &s0);
+ coldiff_huesat(c1, &h1, &s1);
+
+ return coldiff_calc(h0, s0, coldiff_getlum(c0), h1, s1, coldiff_getlum(c1));
+}
@@ -28,6 +28,10 @@
 #include "types.h"
 
 
+/* Calculates balanced hue and saturation of the color, both between 0 and
+** 255. Used by the color difference calculation. */
+void coldiff_huesat(auint c, auint* h, auint* s);
+
 /* Returns a luminosity value for the color, between 0 and 65535 */
 auint coldiff_getlum(auint c0);
 
@@ -35,5 +39,20 @@ auint coldiff_getlum(auint c0);
 ** difference value between 0 and 4096. */
 auint coldiff(auint c0, auint c1);
 
+/* Returns the hue and saturation of the color packed (hue in the low 8
+** bits, saturation in the next 8 bits), for coldiff_hsl(). */
+auint coldiff_hs(auint c);
+
+/* Color difference calculation like coldiff(), from precalculated features
+** of the colors: hue and saturation from coldiff_hs(), and luminosity from
+** coldiff_getlum(). Gives the same result as coldiff(), faster when the same
+** colors are compared a lot. */
+auint coldiff_hsl(auint c0, auint hs0, auint l0, auint c1, auint hs1, auint l1);
+
+/* Returns a lower bound of the color difference of two colors, from their
+** saturation and luminosity only (features as for coldiff_hsl()). Cheaper
+** than the difference, for skipping colors which can not be near enough. */
+auint coldiff_lb(auint hs0, auint l0, auint hs1, auint l1);
+
 
 #endif
@@ -25,7 +25,6 @@
 #include "depthred.h"
 #include "coldepth.h"
 #include "palgen.h"
-#include "idata.h"
 
 
 
@@ -52,6 +51,10 @@ static const uint8 depthred_bct[256] = {
  3, 4, 4, 5, 4, 5, 5, 6, 4, 5, 5, 6, 5, 6, 6, 7,
  4, 5, 5, 6, 5, 6, 6, 7, 5, 6, 6, 7, 6, 7, 7, 8};
 
+/* Minimal target color count. The coarse reduction brings the image down to
+** half of the target, from where depth is selectively increased. */
+#define DR_MINCOLS 320U
+
 /* Internal reference palette size, from which colors are gathered in
 ** selective depth increment */
 #define DR_RPSIZ 16384U
@@ -61,9 +64,9 @@ static iquant_col_t depthred_rcb[8][DR_RPSIZ];
 
 
 
-/* Counts colors using a given target depth in the passed RGB image buffer.
+/* Counts colors using a given target depth in the passed image plane.
 ** The size is specified as pixel count. */
-static auint depthred_cc(uint8 const* buf, auint bsiz, auint depth)
+static auint depthred_cc(auint const* buf, auint bsiz, auint depth)
 {
  auint i;
  auint rgb;
@@ -76,7 +79,7 @@ static auint depthred_cc(uint8 const* buf, auint bsiz, auint depth)
  /* Collect used colors as a bitmap */
 
  for (i = 0U; i < bsiz; i++){
-  rgb = coldepth(idata_get(buf, i), depth);
+  rgb = coldepth(buf[i], depth);
   depthred_ccb[rgb >> 3] |= 1U << (rgb & 0x7U);
  }
 
@@ -92,11 +95,11 @@ static auint depthred_cc(uint8 const* buf, auint bsiz, auint depth)
 
 
 /* Reduces bit depth of the passed image by trimming low bits. The bsiz
-** parameter is the RGB image buffer's size in pixels. The clipped low bits
+** parameter is the image plane's size in pixels. The clipped low bits
 ** are not populated with zero, rather scaled to let them cover the entire
 ** original color range (if clipped, the image would slightly darken as a
 ** result of the quantization which is not desirable). */
-void depthred(uint8 const* buf, auint bsiz, iquant_pal_t* pal, auint cols)
+void depthred(auint const* buf, auint bsiz, iquant_pal_t* pal, auint cols)
 {
  auint dep = 8U;
  auint rdep = 0U;
@@ -109,12 +112,12 @@ void depthred(uint8 const* buf, auint bsiz, iquant_pal_t* pal, auint cols)
  auint c0;
  iquant_pal_t rpal[8];
 
- /* This stage should be used for coarse reducting. So cols must be at least
- ** 1024. */
+ /* This stage should be used for coarse reducting. So cols must not be too
+ ** small. */
 
- if (cols < 1280U){
-  cols = 1280U;
-  printf("Depth reduction: Asked for too few colors, targeting 1280 instead\n");
+ if (cols < DR_MINCOLS){
+  cols = DR_MINCOLS;
+  printf("Depth reduction: Asked for too few colors, targeting %u instead\n", cols);
  }
  if (cols > (pal->mct)){
   printf("Depth reduction: Asked for too many colors, aborting\n");
@@ -125,7 +128,7 @@ void depthred(uint8 const* buf, auint bsiz, iquant_pal_t* pal, auint cols)
  cc = depthred_cc(buf, bsiz, dep);
  printf("Depth reduction: Initial color count: %u (target: %u)\n", cc, cols);
 
- /* Reduce to fit in 1024 colors, meanwhile generating reference palettes
+ /* Reduce to fit in half of the target colors, meanwhile generating reference palettes
  ** for each depth where it is possible */
 
  while (dep > 1U){
@@ -137,7 +140,7 @@ void depthred(uint8 const* buf, auint bsiz, iquant_pal_t* pal, auint cols)
   }else{
    rpal[dep - 1U].cct = 0U;
   }
-  if (cc <= 1024U){ break; } /* Done */
+  if (cc <= (cols >> 1)){ break; } /* Done */
   dep--;
   cc = depthred_cc(buf, bsiz, dep);
   printf("Depth reduction: Depth: %u, Color count: %u (target: %u)\n", dep, cc, cols);
@@ -215,3 +218,91 @@ void depthred(uint8 const* buf, auint bsiz, iquant_pal_t* pal, auint cols)
 
  printf("Depth reduction: Final color count %u\n", pal->cct);
 }
+
+
+
+/* Combines colors of a palette which are identical at the given depth into
+** their occurrence weighted average. Returns the resulting color count. */
+static auint depthred_comb(iquant_pal_t* pal, auint depth)
+{
+ auint i;
+ auint j;
+ auint k;
+ auint c;
+ auint o;
+ uint64 r;
+ uint64 g;
+ uint64 b;
+
+ k = 0U;
+ for (i = 0U; i < (pal->cct); i++){
+  c = coldepth(pal->col[i].col, depth);
+  o = pal->col[i].occ;
+  r = (uint64)((pal->col[i].col >> 16) & 0xFFU) * o;
+  g = (uint64)((pal->col[i].col >>  8) & 0xFFU) * o;
+  b = (uint64)((pal->col[i].col      ) & 0xFFU) * o;
+  for (j = i + 1U; j < (pal->cct); ){ /* Pull in all later matching colors */
+   if (coldepth(pal->col[j].col, depth) == c){
+    o += pal->col[j].occ;
+    r += (uint64)((pal->col[j].col >> 16) & 0xFFU) * pal->col[j].occ;
+    g += (uint64)((pal->col[j].col >>  8) & 0xFFU) * pal->col[j].occ;
+    b += (uint64)((pal->col[j].col      ) & 0xFFU) * pal->col[j].occ;
+    pal->cct --;
+    pal->col[j] = pal->col[pal->cct];
+   }else{
+    j ++;
+   }
+  }
+  if (o != 0U){
+   r = (r + (o >> 1)) / o;
+   g = (g + (o >> 1)) / o;
+   b = (b + (o >> 1)) / o;
+  }
+  pal->col[k].col = (auint)((r << 16) | (g << 8) | b);
+  pal->col[k].occ = o;
+  k ++;
+ }
+
+ pal->cct = k;
+ return k;
+}
+
+
+
+/* Merges a depth reduced palette into another, summing the occurrences of
+** identical colors, so histograms of multiple images may be combined. If the
+** result has more than cols colors, its depth is reduced (averaging colors
+** falling together, weighted by occurrence) until it fits. The destination
+** must have room for cols colors plus the source's colors. Start with an
+** empty destination (cct and ocs zero). */
+void depthred_merge(iquant_pal_t* dst, iquant_pal_t const* src, auint cols)
+{
+ auint i;
+ auint j;
+ auint dep;
+
+ for (i = 0U; i < (src->cct); i++){
+  for (j = 0U; j < (dst->cct); j++){
+   if (dst->col[j].col == src->col[i].col){ break; }
+  }
+  if (j == (dst->cct)){
+   if (j == (dst->mct)){
+    printf("Depth reduction: Merge palette maximum (%u) exceed, aborting\n", dst->mct);
+    return;
+   }
+   dst->col[j].col = src->col[i].col;
+   dst->col[j].occ = 0U;
+   dst->cct ++;
+  }
+  dst->col[j].occ += src->col[i].occ;
+ }
+ dst->ocs += src->ocs;
+
+ dep = 8U;
+ while (((dst->cct) > cols) && (dep > 1U)){
+  dep --;
+  depthred_comb(dst, dep);
+ }
+
+ printf("Depth reduction: Merged palette color count %u\n", dst->cct);
+}
@@ -36,11 +36,22 @@
 
 
 /* Reduces bit depth of the passed image by trimming low bits. The bsiz
-** parameter is the RGB image buffer's size in pixels. The clipped low bits
+** parameter is the image plane's size in pixels. The clipped low bits
 ** are not populated with zero, rather scaled to let them cover the entire
 ** original color range (if clipped, the image would slightly darken as a
-** result of the quantization which is not desirable). */
-void depthred(uint8 const* buf, auint bsiz, iquant_pal_t* pal, auint cols);
+** result of the quantization which is not desirable). The cols parameter is
+** the target color count, which is approached from half of it by selectively
+** increasing depth. */
+void depthred(auint const* buf, auint bsiz, iquant_pal_t* pal, auint cols);
+
+
+/* Merges a depth reduced palette into another, summing the occurrences of
+** identical colors, so histograms of multiple images may be combined. If the
+** result has more than cols colors, its depth is reduced (averaging colors
+** falling together, weighted by occurrence) until it fits. The destination
+** must have room for cols colors plus the source's colors. Start with an
+** empty destination (cct and ocs zero). */
+void depthred_merge(iquant_pal_t* dst, iquant_pal_t const* src, auint cols);
 
 
 #endif
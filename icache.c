@@ -0,0 +1,430 @@
+/**
+**  \file
+**  \brief     InsaniQuant result caches
+**  \author    Sandor Zsuga (Jubatian)
+**  \copyright 2013 - 2017, GNU General Public License version 2 or any later
+**             version, see LICENSE
+**  \date      2017.03.31
+**
+**
+** This program is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 2 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "icache.h"
+#include "ihash.h"
+#ifdef TARGET_LINUX
+#include <sys/stat.h>
+#endif
+#ifdef TARGET_WINDOWS_MINGW
+#include <direct.h>
+#endif
+
+
+
+/* Histogram sidecar magic and format version */
+#define ICACHE_HMAG 0x01485149U /* "IQH", 0x01 */
+
+/* Result cache index magic and format version */
+#define ICACHE_CMAG 0x01435149U /* "IQC", 0x01 */
+
+/* Result cache entry magic and format version */
+#define ICACHE_RMAG 0x01525149U /* "IQR", 0x01 */
+
+/* Maximal length of the result cache directory name */
+#define ICACHE_DLEN 1024U
+
+/* Maximal count of result cache index entries */
+#define ICACHE_EMAX 0x1000000U
+
+/* Result cache index entry */
+typedef struct{
+ uint64 key;        /* Key of the entry */
+ auint  siz;        /* Size of the entry file in bytes */
+ auint  use;        /* Last use (use counter value) */
+}icache_ent_t;
+
+/* Result cache index */
+static icache_ent_t* icache_ind = NULL;
+
+/* Count of entries in the index and size of the index buffer */
+static auint icache_ict;
+static auint icache_ims;
+
+/* Use counter */
+static auint icache_use;
+
+/* Total size of entries and size limit */
+static uint64 icache_tsz;
+static uint64 icache_lim;
+
+/* Result cache directory, and file name work buffer */
+static char icache_dir[ICACHE_DLEN];
+static char icache_fnm[ICACHE_DLEN + 32U];
+
+
+
+/* Writes a 32 bit little endian value. Returns nonzero on success. */
+static auint icache_wr32(FILE* f, auint val)
+{
+ uint8 b[4];
+ b[0] = (val      ) & 0xFFU;
+ b[1] = (val >>  8) & 0xFFU;
+ b[2] = (val >> 16) & 0xFFU;
+ b[3] = (val >> 24) & 0xFFU;
+ return (fwrite(&(b[0]), 1U, 4U, f) == 4U);
+}
+
+
+
+/* Reads a 32 bit little endian value. Returns nonzero on success. */
+static auint icache_rd32(FILE* f, auint* val)
+{
+ uint8 b[4];
+ if (fread(&(b[0]), 1U, 4U, f) != 4U){ return 0U; }
+ *val = ((auint)(b[0])      ) |
+        ((auint)(b[1]) <<  8) |
+        ((auint)(b[2]) << 16) |
+        ((auint)(b[3]) << 24);
+ return 1U;
+}
+
+
+
+/* Loads the depth reduced palette from a histogram sidecar file. Returns
+** nonzero on success, zero if the file doesn't exist, doesn't match the key,
+** or is damaged. */
+auint icache_hload(char const* fnam, uint64 key, iquant_pal_t* pal)
+{
+ FILE* f;
+ auint v[5];
+ auint i;
+ auint r = 1U;
+
+ f = fopen(fnam, "rb");
+ if (f == NULL){ return 0U; }
+
+ for (i = 0U; (i < 5U) && (r); i++){
+  r = icache_rd32(f, &(v[i]));
+ }
+ if ( (!r) ||
+      (v[0] != ICACHE_HMAG) ||
+      (v[1] != (auint)(key & 0xFFFFFFFFU)) ||
+      (v[2] != (auint)(key >> 32)) ||
+      (v[3] > pal->mct) ){ r = 0U; }
+
+ if (r){
+  pal->cct = v[3];
+  pal->ocs = v[4];
+  for (i = 0U; (i < (pal->cct)) && (r); i++){
+   r = icache_rd32(f, &(pal->col[i].col)) &&
+       icache_rd32(f, &(pal->col[i].occ));
+  }
+ }
+
+ fclose(f);
+ if (!r){ pal->cct = 0U; }
+ return r;
+}
+
+
+
+/* Saves the depth reduced palette into a histogram sidecar file. Returns
+** nonzero on success. */
+auint icache_hsave(char const* fnam, uint64 key, iquant_pal_t const* pal)
+{
+ FILE* f;
+ auint i;
+ auint r;
+
+ f = fopen(fnam, "wb");
+ if (f == NULL){ return 0U; }
+
+ r = icache_wr32(f, ICACHE_HMAG) &&
+     icache_wr32(f, (auint)(key & 0xFFFFFFFFU)) &&
+     icache_wr32(f, (auint)(key >> 32)) &&
+     icache_wr32(f, pal->cct) &&
+     icache_wr32(f, pal->ocs);
+ for (i = 0U; (i < (pal->cct)) && (r); i++){
+  r = icache_wr32(f, pal->col[i].col) &&
+      icache_wr32(f, pal->col[i].occ);
+ }
+
+ if (fclose(f)){ r = 0U; }
+ if (!r){ remove(fnam); }
+ return r;
+}
+
+
+
+/* Creates file name within the result cache directory. Name is either an
+** index file name or NULL for an entry by key. */
+static char const* icache_rfnam(char const* nam, uint64 key)
+{
+ char str[17];
+
+ strcpy(icache_fnm, icache_dir);
+ strcat(icache_fnm, "/");
+ if (nam != NULL){
+  strcat(icache_fnm, nam);
+ }else{
+  ihash_str(key, str);
+  strcat(icache_fnm, str);
+  strcat(icache_fnm, ".iqr");
+ }
+ return icache_fnm;
+}
+
+
+
+/* Finds an entry in the result cache index. Returns its index or the entry
+** count if not found. */
+static auint icache_rfind(uint64 key)
+{
+ auint i;
+ for (i = 0U; i < icache_ict; i++){
+  if (icache_ind[i].key == key){ break; }
+ }
+ return i;
+}
+
+
+
+/* Removes an entry from the result cache along with its file. */
+static void icache_rdel(auint i)
+{
+ remove(icache_rfnam(NULL, icache_ind[i].key));
+ icache_tsz -= icache_ind[i].siz;
+ icache_ict --;
+ icache_ind[i] = icache_ind[icache_ict];
+}
+
+
+
+/* Opens the result cache in the given directory (creating it if necessary),
+** with a size limit in bytes. Returns nonzero on success. */
+auint icache_ropen(char const* dir, uint64 lim)
+{
+ FILE* f;
+ auint v[3];
+ auint i;
+ auint r;
+ long  siz = -1L;
+
+ if (strlen(dir) >= ICACHE_DLEN){ return 0U; }
+ strcpy(icache_dir, dir);
+#ifdef TARGET_LINUX
+ mkdir(dir, 0777); /* Fails if exists, which is fine */
+#endif
+#ifdef TARGET_WINDOWS_MINGW
+ _mkdir(dir);
+#endif
+
+ icache_ict = 0U;
+ icache_ims = 0U;
+ icache_use = 0U;
+ icache_tsz = 0U;
+ icache_lim = lim;
+ icache_ind = NULL;
+
+ f = fopen(icache_rfnam("index.iqc", 0U), "rb");
+ if (f == NULL){ /* New cache, check that it is possible to write it */
+  f = fopen(icache_fnm, "wb");
+  if (f == NULL){ return 0U; }
+  fclose(f);
+  return 1U;
+ }
+
+ r = icache_rd32(f, &(v[0])) &&
+     icache_rd32(f, &(v[1])) &&
+     icache_rd32(f, &(v[2]));
+ if ((r) && (v[0] == ICACHE_CMAG)){
+  /* The entry count can not be trusted: it has to fit in the file (16
+  ** bytes each after the 12 byte header) and in the entry limit, otherwise
+  ** only what is there is used. */
+  if (fseek(f, 0L, SEEK_END) == 0){ siz = ftell(f); }
+  if ((siz < 12L) || (fseek(f, 12L, SEEK_SET) != 0)){ siz = 12L; }
+  if ((uint64)(v[2]) > (uint64)((siz - 12L) / 16L)){ v[2] = (auint)((siz - 12L) / 16L); }
+  if (v[2] > ICACHE_EMAX){ v[2] = ICACHE_EMAX; }
+  icache_use = v[1];
+  icache_ims = v[2] + 16U;
+  icache_ind = malloc(sizeof(icache_ent_t) * icache_ims);
+  if (icache_ind == NULL){ icache_ims = 0U; }
+  for (i = 0U; (i < v[2]) && (icache_ims != 0U); i++){
+   if (!( icache_rd32(f, &(v[0])) &&
+          icache_rd32(f, &(v[1])) &&
+          icache_rd32(f, &(icache_ind[i].siz)) &&
+          icache_rd32(f, &(icache_ind[i].use)) )){ break; }
+   icache_ind[i].key = ((uint64)(v[1]) << 32) | v[0];
+   icache_tsz += icache_ind[i].siz;
+   icache_ict ++;
+  }
+ }
+
+ fclose(f);
+ return 1U;
+}
+
+
+
+/* Retrieves an entry from the result cache: the palette and the output of
+** len bytes. Returns nonzero on success. */
+auint icache_rget(uint64 key, iquant_pal_t* pal, uint8* buf, auint len)
+{
+ FILE* f;
+ auint v[5];
+ auint i;
+ auint e;
+ auint r;
+
+ e = icache_rfind(key);
+ if (e == icache_ict){ return 0U; }
+
+ f = fopen(icache_rfnam(NULL, key), "rb");
+ if (f == NULL){ /* Lost entry */
+  icache_rdel(e);
+  return 0U;
+ }
+
+ r = icache_rd32(f, &(v[0])) &&
+     icache_rd32(f, &(v[1])) &&
+     icache_rd32(f, &(v[2])) &&
+     icache_rd32(f, &(v[3]));
+ if ( (!r) ||
+      (v[0] != ICACHE_RMAG) ||
+      (v[1] != (auint)(key & 0xFFFFFFFFU)) ||
+      (v[2] != (auint)(key >> 32)) ||
+      (v[3] > pal->mct) ){ r = 0U; }
+ if (r){
+  pal->cct = v[3];
+  for (i = 0U; (i < (pal->cct)) && (r); i++){
+   r = icache_rd32(f, &(pal->col[i].col));
+   pal->col[i].occ = 0U;
+  }
+ }
+ if (r){
+  r = icache_rd32(f, &(v[4])) &&
+      (v[4] == len) &&
+      (fread(buf, 1U, len, f) == len);
+ }
+
+ fclose(f);
+
+ if (!r){ /* Damaged entry */
+  icache_rdel(e);
+  return 0U;
+ }
+
+ icache_use ++;
+ icache_ind[e].use = icache_use;
+ return 1U;
+}
+
+
+
+/* Stores an entry into the result cache, evicting least recently used
+** entries as necessary to keep within the size limit. Returns nonzero on
+** success. */
+auint icache_rput(uint64 key, iquant_pal_t const* pal, uint8 const* buf, auint len)
+{
+ FILE* f;
+ void* t;
+ auint siz = 16U + (4U * (pal->cct)) + 4U + len; /* Header, palette, output */
+ auint i;
+ auint e;
+ auint r;
+
+ if (siz > icache_lim){ return 0U; } /* Would never fit */
+
+ e = icache_rfind(key);
+ if (e != icache_ict){ icache_rdel(e); }
+
+ /* Evict least recently used entries until the new one fits */
+
+ while ((icache_tsz + siz) > icache_lim){
+  e = 0U;
+  for (i = 1U; i < icache_ict; i++){
+   if (icache_ind[i].use < icache_ind[e].use){ e = i; }
+  }
+  icache_rdel(e);
+ }
+
+ /* Make room in the index */
+
+ if (icache_ict == icache_ims){
+  t = realloc(icache_ind, sizeof(icache_ent_t) * (icache_ims + 64U));
+  if (t == NULL){ return 0U; }
+  icache_ind  = t;
+  icache_ims += 64U;
+ }
+
+ /* Write entry */
+
+ f = fopen(icache_rfnam(NULL, key), "wb");
+ if (f == NULL){ return 0U; }
+
+ r = icache_wr32(f, ICACHE_RMAG) &&
+     icache_wr32(f, (auint)(key & 0xFFFFFFFFU)) &&
+     icache_wr32(f, (auint)(key >> 32)) &&
+     icache_wr32(f, pal->cct);
+ for (i = 0U; (i < (pal->cct)) && (r); i++){
+  r = icache_wr32(f, pal->col[i].col);
+ }
+ r = r && icache_wr32(f, len) &&
+     (fwrite(buf, 1U, len, f) == len);
+
+ if (fclose(f)){ r = 0U; }
+ if (!r){
+  remove(icache_fnm);
+  return 0U;
+ }
+
+ icache_use ++;
+ icache_ind[icache_ict].key = key;
+ icache_ind[icache_ict].siz = siz;
+ icache_ind[icache_ict].use = icache_use;
+ icache_ict ++;
+ icache_tsz += siz;
+ return 1U;
+}
+
+
+
+/* Closes the result cache, writing back its index. */
+void icache_rclose(void)
+{
+ FILE* f;
+ auint i;
+ auint r;
+
+ f = fopen(icache_rfnam("index.iqc", 0U), "wb");
+ if (f != NULL){
+  r = icache_wr32(f, ICACHE_CMAG) &&
+      icache_wr32(f, icache_use) &&
+      icache_wr32(f, icache_ict);
+  for (i = 0U; (i < icache_ict) && (r); i++){
+   r = icache_wr32(f, (auint)(icache_ind[i].key & 0xFFFFFFFFU)) &&
+       icache_wr32(f, (auint)(icache_ind[i].key >> 32)) &&
+       icache_wr32(f, icache_ind[i].siz) &&
+       icache_wr32(f, icache_ind[i].use);
+  }
+  if (fclose(f)){ r = 0U; }
+  if (!r){ remove(icache_fnm); } /* Better no index than a broken one */
+ }
+
+ free(icache_ind);
+ icache_ind = NULL;
+ icache_ict = 0U;
+ icache_ims = 0U;
+}
@@ -0,0 +1,87 @@
+/**
+**  \file
+**  \brief     InsaniQuant result caches
+**  \author    Sandor Zsuga (Jubatian)
+**  \copyright 2013 - 2017, GNU General Public License version 2 or any later
+**             version, see LICENSE
+**  \date      2017.03.31
+**
+**
+** This program is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 2 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+**
+**
+** Files persisting intermediate or final results between runs, keyed by
+** hashes of the input and the parameters affecting the result.
+**
+** Histogram sidecar format (all values 32 bit little endian):
+** - Magic: "IQH" and a format version byte.
+** - Key: 64 bit hash, low 32 bits first.
+** - Color count and occurrence sum of the depth reduced palette.
+** - For every color: RGB color value, occurrence.
+**
+** The result cache is a directory holding final outputs (palette and output
+** image) keyed by a hash of the input and all the parameters. Its size is
+** bounded, least recently used entries are evicted. An index file in the
+** directory (index.iqc) tracks the entries:
+** - Magic: "IQC" and a format version byte.
+** - Use counter, entry count.
+** - For every entry: 64 bit key (low 32 bits first), size in bytes, last
+**   use (value of the use counter).
+** Entry files are named by the key in hexadecimal with an .iqr extension:
+** - Magic: "IQR" and a format version byte.
+** - Key, palette color count, palette colors, output size in bytes.
+** - Output bytes.
+*/
+
+
+#ifndef ICACHE_H
+#define ICACHE_H
+
+#include "types.h"
+
+
+
+/* Loads the depth reduced palette from a histogram sidecar file. Returns
+** nonzero on success, zero if the file doesn't exist, doesn't match the key,
+** or is damaged. */
+auint icache_hload(char const* fnam, uint64 key, iquant_pal_t* pal);
+
+
+/* Saves the depth reduced palette into a histogram sidecar file. Returns
+** nonzero on success. */
+auint icache_hsave(char const* fnam, uint64 key, iquant_pal_t const* pal);
+
+
+
+/* Opens the result cache in the given directory (creating it if necessary),
+** with a size limit in bytes. Returns nonzero on success. */
+auint icache_ropen(char const* dir, uint64 lim);
+
+
+/* Retrieves an entry from the result cache: the palette and the output of
+** len bytes. Returns nonzero on success. */
+auint icache_rget(uint64 key, iquant_pal_t* pal, uint8* buf, auint len);
+
+
+/* Stores an entry into the result cache, evicting least recently used
+** entries as necessary to keep within the size limit. Returns nonzero on
+** success. */
+auint icache_rput(uint64 key, iquant_pal_t const* pal, uint8 const* buf, auint len);
+
+
+/* Closes the result cache, writing back its index. */
+void icache_rclose(void);
+
+
+#endif
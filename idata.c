@@ -26,21 +26,85 @@
 
 
 
-/* Retrieves color value at a given pixel index (linear) from the image
-** buffer. */
-auint idata_get(uint8 const* buf, auint i)
+/* Unpacks cnt pixels of packed 24 bit RGB image data (as in the files) from
+** src into the image plane dst, one color (0x00RRGGBB) in each element. The
+** stages work on such planes, so every pixel access is a single load. */
+void idata_unpack(uint8 const* src, auint* dst, auint cnt)
 {
- return (buf[(i * 3U) + 0U] << 16) |
-        (buf[(i * 3U) + 1U] <<  8) |
-        (buf[(i * 3U) + 2U]      );
+ auint i;
+
+ for (i = 0U; i < cnt; i++){
+  dst[i] = ((auint)(src[0]) << 16) |
+           ((auint)(src[1]) <<  8) |
+           ((auint)(src[2])      );
+  src += 3U;
+ }
 }
 
 
-/* Sets a color value at a given pixel index (linear) into the image
-** buffer. */
-void idata_set(uint8* buf, auint i, auint col)
+/* Packs cnt pixels of the image plane src into packed 24 bit RGB image data
+** in dst. */
+void idata_pack(auint const* src, uint8* dst, auint cnt)
+{
+ auint i;
+
+ for (i = 0U; i < cnt; i++){
+  dst[0] = (src[i] >> 16) & 0xFFU;
+  dst[1] = (src[i] >>  8) & 0xFFU;
+  dst[2] = (src[i]      ) & 0xFFU;
+  dst += 3U;
+ }
+}
+
+
+
+/* Unpacks cnt pixels of packed 32 bit RGBA image data from src into the
+** image plane dst like idata_unpack(), fully transparent pixels becoming
+** IDATA_TRANSP. Other alpha values are not represented in the plane. */
+void idata_unpack_rgba(uint8 const* src, auint* dst, auint cnt)
+{
+ auint i;
+ for (i = 0U; i < cnt; i++){
+  if (src[3] == 0U){
+   dst[i] = IDATA_TRANSP;
+  }else{
+   dst[i] = ((auint)(src[0]) << 16) |
+            ((auint)(src[1]) <<  8) |
+            ((auint)(src[2])      );
+  }
+  src += 4U;
+ }
+}
+
+
+
+/* Packs cnt pixels of the image plane src into packed 32 bit RGBA image
+** data in dst. Only the color components are written, so the alpha of the
+** image unpacked from dst is kept. Fully transparent pixels become black. */
+void idata_pack_rgba(auint const* src, uint8* dst, auint cnt)
+{
+ auint i;
+ for (i = 0U; i < cnt; i++){
+  dst[0] = (src[i] >> 16) & 0xFFU;
+  dst[1] = (src[i] >>  8) & 0xFFU;
+  dst[2] = (src[i]      ) & 0xFFU;
+  dst += 4U;
+ }
+}
+
+
+
+/* Collects the opaque (not fully transparent) pixels of cnt pixels of the
+** image plane src into dst. Returns the count of pixels collected. */
+auint idata_opaque(auint const* src, auint* dst, auint cnt)
 {
- buf[(i * 3U) + 0U] = (col >> 16) & 0xFFU;
- buf[(i * 3U) + 1U] = (col >>  8) & 0xFFU;
- buf[(i * 3U) + 2U] = (col      ) & 0xFFU;
+ auint i;
+ auint r = 0U;
+ for (i = 0U; i < cnt; i++){
+  if (src[i] != IDATA_TRANSP){
+   dst[r] = src[i];
+   r ++;
+  }
+ }
+ return r;
 }
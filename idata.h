@@ -29,14 +29,37 @@
 
 
 
-/* Retrieves color value at a given pixel index (linear) from the image
-** buffer. */
-auint idata_get(uint8 const* buf, auint i);
+/* Image plane value of a fully transparent pixel (RGBA images). Being over
+** 24 bits, it can not collide with any color. */
+#define IDATA_TRANSP 0x01000000U
 
 
-/* Sets a color value at a given pixel index (linear) into the image
-** buffer. */
-void idata_set(uint8* buf, auint i, auint col);
+/* Unpacks cnt pixels of packed 24 bit RGB image data (as in the files) from
+** src into the image plane dst, one color (0x00RRGGBB) in each element. The
+** stages work on such planes, so every pixel access is a single load. */
+void idata_unpack(uint8 const* src, auint* dst, auint cnt);
+
+
+/* Packs cnt pixels of the image plane src into packed 24 bit RGB image data
+** in dst. */
+void idata_pack(auint const* src, uint8* dst, auint cnt);
+
+
+/* Unpacks cnt pixels of packed 32 bit RGBA image data from src into the
+** image plane dst like idata_unpack(), fully transparent pixels becoming
+** IDATA_TRANSP. Other alpha values are not represented in the plane. */
+void idata_unpack_rgba(uint8 const* src, auint* dst, auint cnt);
+
+
+/* Packs cnt pixels of the image plane src into packed 32 bit RGBA image
+** data in dst. Only the color components are written, so the alpha of the
+** image unpacked from dst is kept. Fully transparent pixels become black. */
+void idata_pack_rgba(auint const* src, uint8* dst, auint cnt);
+
+
+/* Collects the opaque (not fully transparent) pixels of cnt pixels of the
+** image plane src into dst. Returns the count of pixels collected. */
+auint idata_opaque(auint const* src, auint* dst, auint cnt);
 
 
 #endif
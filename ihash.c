@@ -0,0 +1,67 @@
+/**
+**  \file
+**  \brief     InsaniQuant hashing tools
+**  \author    Sandor Zsuga (Jubatian)
+**  \copyright 2013 - 2017, GNU General Public License version 2 or any later
+**             version, see LICENSE
+**  \date      2017.03.31
+**
+**
+** This program is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 2 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "ihash.h"
+
+
+
+/* FNV-1a prime */
+#define IHASH_PRIME 0x00000100000001B3ULL
+
+
+
+/* Adds a block of bytes to the hash, returning the new hash value. */
+uint64 ihash_buf(uint64 h, void const* buf, auint len)
+{
+ uint8 const* b = buf;
+ auint i;
+
+ for (i = 0U; i < len; i++){
+  h = (h ^ b[i]) * IHASH_PRIME;
+ }
+
+ return h;
+}
+
+
+
+/* Adds a 32 bit value to the hash (byte order independent), returning the
+** new hash value. */
+uint64 ihash_val(uint64 h, auint val)
+{
+ h = (h ^ ((val      ) & 0xFFU)) * IHASH_PRIME;
+ h = (h ^ ((val >>  8) & 0xFFU)) * IHASH_PRIME;
+ h = (h ^ ((val >> 16) & 0xFFU)) * IHASH_PRIME;
+ h = (h ^ ((val >> 24) & 0xFFU)) * IHASH_PRIME;
+ return h;
+}
+
+
+
+/* Prints a hash value as 16 hexadecimal digits into the passed string, which
+** must be able to hold at least 17 characters. */
+void ihash_str(uint64 h, char* str)
+{
+ sprintf(str, "%08X%08X", (auint)(h >> 32), (auint)(h & 0xFFFFFFFFU));
+}
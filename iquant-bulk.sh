@@ -5,20 +5,19 @@ if [ "$#" -lt 2 ] || [ ! -d "$1" ]; then
     echo "- A directory to process png images within"
     echo "- A color count to quantize every image to (256 or less)"
     echo "- (Optional) target palette bit depth (1 - 8)"
-    echo "- (Optional) turn on dithering ('d')"
+    echo "- (Optional) turn on dithering ('d', or 'o' for ordered)"
     exit 1
 fi
 
 for i in ${1}/*.png; do
-    convert ${i} -alpha opaque -print "%w %h;" ${i}.rgb >${i}.tmp
+    convert ${i} -alpha set -print "%w %h;" ${i}.rgba >${i}.tmp
     read -d ";" -s wd hg <${i}.tmp
     rm ${i}.tmp
-    ./insaniquant ${i}.rgb ${wd} ${hg} ${2} ${i}.rgb.tmp ${3} ${4}
-    rm ${i}.rgb
-    mv ${i}.rgb.tmp ${i}.rgb
-    convert +dither -colors ${2} -depth 8 -size ${wd}x${hg} rgb:${i}.rgb ${i}.t.png
-    rm ${i}.rgb
-    convert ${i}.t.png ${i} -alpha set -compose copy-opacity -composite ${i}.t.png
+    ./insaniquant ${i}.rgba ${wd} ${hg} ${2} ${i}.rgba.tmp ${3} ${4} --rgba
+    rm ${i}.rgba
+    mv ${i}.rgba.tmp ${i}.rgba
+    convert -depth 8 -size ${wd}x${hg} rgba:${i}.rgba ${i}.t.png
+    rm ${i}.rgba
     pngcrush ${i}.t.png ${i}
     rm ${i}.t.png
 done
@@ -6,17 +6,16 @@ if [ "$#" -lt 3 ] || [ ! -f "$1" ]; then
     echo "- A color count to quantize the image to (256 or less)"
     echo "- An output image file"
     echo "- (Optional) target palette bit depth (1 - 8)"
-    echo "- (Optional) turn on dithering ('d')"
+    echo "- (Optional) turn on dithering ('d', or 'o' for ordered)"
     exit 1
 fi
-convert $1 -alpha opaque -print "%w %h;" $1.rgb >$1.tmp
+convert $1 -alpha set -print "%w %h;" $1.rgba >$1.tmp
 read -d ";" -s wd hg <$1.tmp
 rm $1.tmp
-./insaniquant $1.rgb ${wd} ${hg} $2 $3.rgb $4 $5
-rm $1.rgb
-convert -colors $2 -depth 8 -size ${wd}x${hg} rgb:$3.rgb $3
-rm $3.rgb
-convert $3 $1 -alpha set -compose copy-opacity -composite $3
+./insaniquant $1.rgba ${wd} ${hg} $2 $3.rgba $4 $5 --rgba
+rm $1.rgba
+convert -depth 8 -size ${wd}x${hg} rgba:$3.rgba $3
+rm $3.rgba
 pngcrush $3 $3.tmp
 rm $3
 mv $3.tmp $3
@@ -0,0 +1,168 @@
+/**
+**  \file
+**  \brief     InsaniQuant run statistics
+**  \author    Sandor Zsuga (Jubatian)
+**  \copyright 2013 - 2017, GNU General Public License version 2 or any later
+**             version, see LICENSE
+**  \date      2017.03.31
+**
+**
+** This program is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 2 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "istat.h"
+#include "itime.h"
+#include "version.h"
+#ifdef TARGET_LINUX
+#include <sys/resource.h>
+#endif
+
+
+
+#ifdef TARGET_STATS
+
+/* Counter values */
+uint64 istat_cnt[ISTAT_CNT];
+
+/* Accumulated stage times */
+static double istat_stm[ISTAT_S_CNT];
+
+/* Stage start times */
+static double istat_sbg[ISTAT_S_CNT];
+
+/* Memory allocated */
+static uint64 istat_mal;
+
+#endif
+
+/* Counter names */
+static char const* const istat_cnam[ISTAT_CNT] = {
+ "coldiff",
+ "coldepth_d",
+ "mquant_split",
+ "mquant_reject",
+ "rearrange",
+ "rearrange_iter",
+ "rearrange_conv",
+ "flat_hit",
+ "flat_miss",
+ "seq_keep",
+ "coldepth_d_miss",
+ "dither_memo_hit",
+ "dither_memo_miss",
+ "dither_pixels",
+ "dither_flat_pixels",
+ "ordered_hit",
+ "ordered_miss"};
+
+/* Stage names */
+static char const* const istat_snam[ISTAT_S_CNT] = {
+ "load",
+ "depthred",
+ "mquant",
+ "palapp",
+ "write"};
+
+
+
+/* Starts timing a stage. A stage may be entered multiple times, the times
+** accumulate. */
+void istat_beg(auint st)
+{
+#ifdef TARGET_STATS
+ istat_sbg[st] = itime_get();
+#endif
+}
+
+
+
+/* Ends timing a stage. */
+void istat_end(auint st)
+{
+#ifdef TARGET_STATS
+ istat_stm[st] += itime_get() - istat_sbg[st];
+#endif
+}
+
+
+
+/* Records a memory allocation of the given size in bytes. */
+void istat_mem(uint64 siz)
+{
+#ifdef TARGET_STATS
+ istat_mal += siz;
+#endif
+}
+
+
+
+/* Writes out the collected statistics, as CSV if csv is nonzero, JSON
+** otherwise. Returns nonzero if statistics are compiled in. */
+auint istat_write(FILE* f, auint csv)
+{
+#ifdef TARGET_STATS
+ auint  i;
+ uint64 rss = 0U;
+#ifdef TARGET_LINUX
+ struct rusage ru;
+
+ if (getrusage(RUSAGE_SELF, &ru) == 0){
+  rss = (uint64)(ru.ru_maxrss) * 1024U;
+ }
+#endif
+
+ if (csv){
+
+  fprintf(f, "kind,name,value\n");
+  for (i = 0U; i < ISTAT_S_CNT; i++){
+   fprintf(f, "time,%s,%.6f\n", istat_snam[i], istat_stm[i]);
+  }
+  for (i = 0U; i < ISTAT_CNT; i++){
+   fprintf(f, "count,%s,%llu\n", istat_cnam[i], (unsigned long long)(istat_cnt[i]));
+  }
+  fprintf(f, "memory,alloc,%llu\n", (unsigned long long)(istat_mal));
+  fprintf(f, "memory,peak_rss,%llu\n", (unsigned long long)(rss));
+
+ }else{
+
+  fprintf(f, "{\n");
+  fprintf(f, " \"version\": \"%s\",\n", IQUANT_VERSION);
+  fprintf(f, " \"time\": {");
+  for (i = 0U; i < ISTAT_S_CNT; i++){
+   fprintf(f, "%s\n  \"%s\": %.6f", (i == 0U) ? "" : ",", istat_snam[i], istat_stm[i]);
+  }
+  fprintf(f, "\n },\n");
+  fprintf(f, " \"count\": {");
+  for (i = 0U; i < ISTAT_CNT; i++){
+   fprintf(f, "%s\n  \"%s\": %llu", (i == 0U) ? "" : ",", istat_cnam[i], (unsigned long long)(istat_cnt[i]));
+  }
+  fprintf(f, "\n },\n");
+  fprintf(f, " \"memory\": {\n");
+  fprintf(f, "  \"alloc\": %llu,\n", (unsigned long long)(istat_mal));
+  fprintf(f, "  \"peak_rss\": %llu\n", (unsigned long long)(rss));
+  fprintf(f, " }\n");
+  fprintf(f, "}\n");
+
+ }
+
+ return 1U;
+#else
+ (void)(f);
+ (void)(csv);
+ (void)(istat_cnam);
+ (void)(istat_snam);
+ return 0U;
+#endif
+}
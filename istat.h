@@ -0,0 +1,106 @@
+/**
+**  \file
+**  \brief     InsaniQuant run statistics
+**  \author    Sandor Zsuga (Jubatian)
+**  \copyright 2013 - 2017, GNU General Public License version 2 or any later
+**             version, see LICENSE
+**  \date      2017.03.31
+**
+**
+** This program is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 2 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+**
+**
+** Optional instrumentation of the quantizer: stage timings, call and event
+** counters, and memory use. It is only compiled in when TARGET_STATS is
+** defined (see Make_config.mk), otherwise the macros below produce no code.
+*/
+
+
+#ifndef ISTAT_H
+#define ISTAT_H
+
+#include "types.h"
+
+
+
+/* Counters */
+#define ISTAT_COLDIFF    0U    /* coldiff() calls */
+#define ISTAT_COLDEPTH_D 1U    /* coldepth_d() calls */
+#define ISTAT_MQ_SPLIT   2U    /* mquant split attempts */
+#define ISTAT_MQ_REJECT  3U    /* mquant rejected splits (mquant_dis hits) */
+#define ISTAT_MQ_REARR   4U    /* mquant_rearrange() calls */
+#define ISTAT_MQ_RITR    5U    /* mquant_rearrange() iterations */
+#define ISTAT_MQ_RCONV   6U    /* mquant_rearrange() calls converging early */
+#define ISTAT_FLAT_HIT   7U    /* Flat palette apply: same color as previous */
+#define ISTAT_FLAT_MISS  8U    /* Flat palette apply: palette searched */
+#define ISTAT_SEQ_KEEP   9U    /* Sequence: pixel kept from previous frame */
+#define ISTAT_COLDEPTH_M 10U   /* coldepth_d() cache misses (searches) */
+#define ISTAT_DMEMO_HIT  11U   /* Dither: decision reused from the memo */
+#define ISTAT_DMEMO_MISS 12U   /* Dither: decision calculated */
+#define ISTAT_HYB_DITH   13U   /* Dither: pixel dithered */
+#define ISTAT_HYB_FLAT   14U   /* Dither: busy pixel, nearest color (hybrid) */
+#define ISTAT_ORD_HIT    15U   /* Ordered dither: decision reused from the cache */
+#define ISTAT_ORD_MISS   16U   /* Ordered dither: decision calculated */
+#define ISTAT_CNT       17U    /* Count of counters */
+
+/* Stages */
+#define ISTAT_S_LOAD     0U    /* Loading the input */
+#define ISTAT_S_DEPTHRED 1U    /* Depth reduction */
+#define ISTAT_S_MQUANT   2U    /* Main quantizer pass */
+#define ISTAT_S_PALAPP   3U    /* Palette application */
+#define ISTAT_S_WRITE    4U    /* Writing the output */
+#define ISTAT_S_CNT      5U    /* Count of stages */
+
+
+#ifdef TARGET_STATS
+
+/* Counter values */
+extern uint64 istat_cnt[ISTAT_CNT];
+
+#define ISTAT_INC(id)    (istat_cnt[(id)] ++)
+#define ISTAT_ADD(id, v) (istat_cnt[(id)] += (v))
+#define ISTAT_BEG(st)    istat_beg(st)
+#define ISTAT_END(st)    istat_end(st)
+#define ISTAT_MEM(v)     istat_mem(v)
+
+#else
+
+#define ISTAT_INC(id)
+#define ISTAT_ADD(id, v)
+#define ISTAT_BEG(st)
+#define ISTAT_END(st)
+#define ISTAT_MEM(v)
+
+#endif
+
+
+/* Starts timing a stage. A stage may be entered multiple times, the times
+** accumulate. */
+void istat_beg(auint st);
+
+
+/* Ends timing a stage. */
+void istat_end(auint st);
+
+
+/* Records a memory allocation of the given size in bytes. */
+void istat_mem(uint64 siz);
+
+
+/* Writes out the collected statistics, as CSV if csv is nonzero, JSON
+** otherwise. Returns nonzero if statistics are compiled in. */
+auint istat_write(FILE* f, auint csv);
+
+
+#endif
@@ -0,0 +1,44 @@
+/**
+**  \file
+**  \brief     InsaniQuant timing tools
+**  \author    Sandor Zsuga (Jubatian)
+**  \copyright 2013 - 2017, GNU General Public License version 2 or any later
+**             version, see LICENSE
+**  \date      2017.03.31
+**
+**
+** This program is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 2 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "itime.h"
+#include <time.h>
+
+
+
+/* Returns a monotonic time stamp in seconds. Only differences between time
+** stamps are meaningful. */
+double itime_get(void)
+{
+#ifdef TARGET_LINUX
+ struct timespec ts;
+
+ clock_gettime(CLOCK_MONOTONIC, &ts);
+ return (double)(ts.tv_sec) + ((double)(ts.tv_nsec) * 1.0e-9);
+#else
+ /* No portable wall clock with a fine enough resolution, fall back to
+ ** processor time which is equivalent for this single threaded program. */
+ return (double)(clock()) / (double)(CLOCKS_PER_SEC);
+#endif
+}
@@ -23,6 +23,7 @@
 **
 ** Short usage summary:
 ** insaniquant infile.rgb width heigh colors outfile.rgb [depth] [dither]
+** [options]
 */
 
 
@@ -32,6 +33,15 @@
 #include "depthred.h"
 #include "mquant.h"
 #include "palapp.h"
+#include "ihash.h"
+#include "istat.h"
+#include "itime.h"
+#include "icache.h"
+#include "palgen.h"
+#include "palut.h"
+#include "idata.h"
+#include "tilepal.h"
+#include "coldepth.h"
 
 
 
@@ -45,6 +55,42 @@ static char const* main_copyrig = "Copyright: 2013 - 2017, GNU General Public Li
 
 
 
+/* Maximal count of color counts to produce outputs for in one run */
+#define MAIN_CMAX 16U
+
+/* Maximal count of (depth, dithering) variants in one run */
+#define MAIN_VMAX 16U
+
+/* Dithering request names by value (none, dithering, ordered dithering), as
+** appended to variants */
+static char const* const main_dnam[3] = {"", "d", "o"};
+
+/* Maximal count of images sharing a palette in one run */
+#define MAIN_IMAX 256U
+
+/* Maximal total count of pixels of the images sharing a palette. The
+** occurrence counts of the palettes are 32 bits, this keeps their sums in
+** range with some headroom. */
+#define MAIN_PMAX 0x80000000U
+
+/* Overflowed allocation size */
+#define MAIN_SOVF (~(uint64)(0U))
+
+/* Speed / quality presets, tuning the most expensive parameters together */
+typedef struct{
+ char const* nam;   /* Name of the preset */
+ auint drc;         /* Depth reduction target color count (mquant input) */
+ auint itr[4];      /* Rearrangement iterations (see mquant_setitr) */
+ auint dst[5];      /* Dithering strengths (see palapp_setdst) */
+}main_prs_t;
+
+static const main_prs_t main_prs[3] = {
+ {"fast",      384U, {1U, 1U, 1U, 1U}, {5U, 4U, 3U, 2U, 2U}},
+ {"balanced", 2048U, {4U, 3U, 2U, 1U}, {6U, 5U, 4U, 3U, 2U}},
+ {"best",     2048U, {8U, 6U, 4U, 2U}, {7U, 6U, 5U, 4U, 3U}}};
+
+
+
 /* Scan a decimal value (process parameters) */
 
 auint main_sdec(char const* str)
@@ -78,22 +124,446 @@ auint main_shex(char const* str)
 
 
 
+/* Scan a comma separated list of decimal values (process parameters). Returns
+** the count of values found, zero if the list is malformed or has more than
+** cnt values. */
+
+auint main_slst(char const* str, auint* val, auint cnt)
+{
+ auint i = 0U;
+ auint j = 0U;
+ while (j < cnt){
+  if ((str[i] < '0') || (str[i] > '9')){ return 0U; }
+  val[j] = main_sdec(&(str[i]));
+  while ((str[i] >= '0') && (str[i] <= '9')){ i ++; }
+  j ++;
+  if (str[i] != ','){ break; }
+  i ++;
+ }
+ if (str[i] != 0){ return 0U; }
+ return j;
+}
+
+
+
+/* Creates output file name for one of multiple outputs, inserting a suffix
+** before the extension of the base name (if any). The destination must be
+** large enough to hold the base name and the suffix. */
+
+void main_onam(char* dst, char const* fnam, char const* sfx)
+{
+ auint i;
+ auint e = strlen(fnam);
+
+ for (i = 0U; fnam[i] != 0; i++){
+  if      (fnam[i] == '.'){ e = i; }
+  else if ((fnam[i] == '/') || (fnam[i] == '\\')){ e = strlen(fnam); }
+ }
+
+ memcpy(dst, fnam, e);
+ strcpy(&(dst[e]), sfx);
+ strcat(dst, &(fnam[e]));
+}
+
+
+
+/* Writes a buffer into a file. Returns nonzero on success. */
+
+auint main_write(char const* fnam, uint8 const* buf, auint len)
+{
+ FILE*  f_out;
+ size_t s_tmp;
+
+ f_out = fopen(fnam, "wb");
+ if (f_out == NULL){
+  perror("Could not open output file");
+  return 0U;
+ }
+
+ s_tmp = fwrite(buf, 1, len, f_out); /* Note: fits in 32 bit unsigned int due to size limits */
+ if (len != (auint)(s_tmp)){
+  fprintf(stderr, "Warning: output file didn't accept the whole image! (%u <=> %u size)\n", len, (auint)(s_tmp));
+ }
+
+ if (fclose(f_out)){
+  perror("Could not close output file");
+  return 0U;
+ }
+
+ return 1U;
+}
+
+
+
+/* Reads a whole file (up to the size of the largest image) into a newly
+** allocated buffer, which is zero terminated for text. Returns NULL on
+** failure, otherwise the buffer to be freed by the caller, with the size in
+** len. */
+
+uint8* main_rfile(char const* fnam, auint* len)
+{
+ FILE*  f_inp;
+ uint8* buf = NULL;
+ long   siz;
+
+ f_inp = fopen(fnam, "rb");
+ if (f_inp == NULL){
+  perror("Could not open file");
+  return NULL;
+ }
+
+ if (fseek(f_inp, 0L, SEEK_END) == 0){
+  siz = ftell(f_inp);
+  if ((siz >= 0L) && (siz <= (16384L * 16384L * 4L)) && (fseek(f_inp, 0L, SEEK_SET) == 0)){
+   buf = malloc((size_t)(siz) + 1U);
+   if (buf != NULL){
+    if (fread(buf, 1, (size_t)(siz), f_inp) == (size_t)(siz)){
+     buf[siz] = 0U;
+     *len = (auint)(siz);
+    }else{
+     free(buf);
+     buf = NULL;
+    }
+   }
+  }
+ }
+
+ fclose(f_inp);
+ return buf;
+}
+
+
+
+/* Scans an image list (of a shared palette run) in a zero terminated buffer,
+** each entry being an input file name, width, height and output file name
+** separated by white space. The buffer is split up in place into the file
+** names. Returns the count of entries, zero if the list is malformed or has
+** more than cnt entries. */
+
+auint main_sinp(char* buf, char** nam, auint* w, auint* h, char** out, auint cnt)
+{
+ char* tok[4];
+ auint i = 0U;
+ auint j = 0U;
+ auint k;
+
+ while (1){
+  for (k = 0U; k < 4U; k++){
+   while ((buf[i] == ' ') || (buf[i] == '\t') || (buf[i] == '\r') || (buf[i] == '\n')){ i ++; }
+   if (buf[i] == 0){ break; }
+   tok[k] = &(buf[i]);
+   while ((buf[i] != 0) && (buf[i] != ' ') && (buf[i] != '\t') && (buf[i] != '\r') && (buf[i] != '\n')){ i ++; }
+   if (buf[i] != 0){
+    buf[i] = 0;
+    i ++;
+   }
+  }
+  if (k == 0U){ break; }        /* End of list */
+  if ((k != 4U) || (j == cnt)){ return 0U; }
+  nam[j] = tok[0];
+  w[j]   = main_sdec(tok[1]);
+  h[j]   = main_sdec(tok[2]);
+  out[j] = tok[3];
+  j ++;
+ }
+
+ return j;
+}
+
+
+
+/* Loads an image of cnt pixels into buf (packed RGB or RGBA by bpp, bytes
+** per pixel, as in the file), and unpacks it into the image plane pln.
+** Returns nonzero on success. */
+
+auint main_load(char const* fnam, uint8* buf, auint* pln, auint cnt, auint bpp)
+{
+ FILE*  f_inp;
+ size_t s_tmp;
+ auint  len = cnt * bpp;
+
+ ISTAT_BEG(ISTAT_S_LOAD);
+ f_inp = fopen(fnam, "rb");
+ if (f_inp == NULL){
+  perror("Could not open input file");
+  return 0U;
+ }
+
+ s_tmp = fread(buf, 1, len, f_inp); /* Note: fits in 32 bit unsigned int due to size limits */
+ if (len != (auint)(s_tmp)){
+  fprintf(stderr, "Warning: input file size didn't match dimensions! (%u <=> %u size)\n", len, (auint)(s_tmp));
+ }
+
+ fclose(f_inp); /* Don't care about close error on the input... Not my damn problem */
+ if (bpp == 4U){ idata_unpack_rgba(buf, pln, cnt); }
+ else          { idata_unpack(buf, pln, cnt); }
+ ISTAT_END(ISTAT_S_LOAD);
+
+ return 1U;
+}
+
+
+
+/* Loads a palette from an .rgb (or .rgba by bpp, bytes per pixel) file,
+** such as an output of a previous run: its distinct colors make the
+** palette, fully transparent pixels excluded. Returns nonzero on success. */
+
+auint main_lpal(char const* fnam, iquant_pal_t* spal, auint bpp)
+{
+ uint8* buf;
+ auint* pln = NULL;
+ auint  len = 0U;
+ auint  cnt;
+ auint  r = 0U;
+
+ buf = main_rfile(fnam, &len);
+ cnt = len / bpp;
+ if ((buf != NULL) && (cnt != 0U)){
+  pln = malloc(sizeof(auint) * cnt);
+ }
+ if (pln != NULL){
+  if (bpp == 4U){
+   idata_unpack_rgba(buf, pln, cnt);
+   cnt = idata_opaque(pln, pln, cnt);
+  }else{
+   idata_unpack(buf, pln, cnt);
+  }
+  r = palgen(pln, cnt, spal, 0x888U);
+  if (!r){
+   fprintf(stderr, "Palette file has more than %u colors\n", spal->mct);
+  }
+ }
+ free(pln);
+ free(buf);
+
+ if ((!r) || (spal->cct == 0U)){
+  fprintf(stderr, "Could not load palette from %s\n", fnam);
+  return 0U;
+ }
+ return 1U;
+}
+
+
+
+/* Depth reduces an image plane of cnt pixels into pal (see depthred()). In
+** RGBA mode only the opaque pixels are collected (into wrk) and reduced, so
+** transparent pixels take no part in the palette. */
+
+void main_dred(auint const* buf, auint* wrk, auint cnt, auint rgba, iquant_pal_t* pal, auint cols)
+{
+ if (rgba){
+  cnt = idata_opaque(buf, wrk, cnt);
+  if (cnt == 0U){ /* Fully transparent, any palette would do */
+   wrk[0] = 0U;
+   cnt    = 1U;
+  }
+  buf = wrk;
+ }
+ depthred(buf, cnt, pal, cols);
+}
+
+
+
+/* Checks whether a bit depth (1 - 8, or 3 digits for R:G:B) is valid. Returns
+** nonzero if so. */
+
+auint main_cdep(auint dep)
+{
+ return !( ( (dep <     1U) || (dep >     8U) ) &&
+           ( (dep < 0x111U) || (dep > 0x888U) ||
+             ((dep & 0xFU) > 0x8U) || ((dep & 0xFFU) > 0x88U) ||
+             ((dep & 0xFU) < 0x1U) || ((dep & 0xFFU) < 0x11U) ) );
+}
+
+
+
+/* Scan a comma separated list of variants: bit depths, each optionally
+** followed by a 'd' to request dithering or an 'o' for ordered dithering,
+** such as "8,444d,332o". Returns the count of variants found, zero if the
+** list is malformed or has more than cnt variants. */
+
+auint main_svar(char const* str, auint* dep, auint* dit, auint cnt)
+{
+ auint i = 0U;
+ auint j = 0U;
+ auint b;
+ while (j < cnt){
+  dep[j] = 0U;
+  b = i;
+  while ((str[i] >= '0') && (str[i] <= '9')){
+   dep[j] = (dep[j] << 4) + (auint)(str[i] - '0');
+   i ++;
+  }
+  if ((i == b) || ((i - b) > 3U)){ return 0U; }
+  dit[j] = 0U;
+  if       ((str[i] == 'd') || (str[i] == 'D')){ /* Dithering request */
+   dit[j] = 1U;
+   i ++;
+  }else if ((str[i] == 'o') || (str[i] == 'O')){ /* Ordered dithering request */
+   dit[j] = 2U;
+   i ++;
+  }
+  if (!main_cdep(dep[j])){ return 0U; }
+  j ++;
+  if (str[i] != ','){ break; }
+  i ++;
+ }
+ if (str[i] != 0){ return 0U; }
+ return j;
+}
+
+
+
+/* Checks an option parameter against an option name. Returns the option's
+** value (after a '='), an empty string if it has no value, or NULL if the
+** parameter is not the given option. */
+
+char const* main_sopt(char const* str, char const* nam)
+{
+ auint i = 0U;
+ while (nam[i] != 0){
+  if (str[i] != nam[i]){ return NULL; }
+  i ++;
+ }
+ if (str[i] == '='){ return &(str[i + 1U]); }
+ if (str[i] == 0  ){ return &(str[i]); }
+ return NULL;
+}
+
+
+
+/* Adds cnt elements of siz bytes to the allocation size tot. Returns the
+** new size, or MAIN_SOVF if it would overflow (which is also passed on by
+** later additions). */
+
+uint64 main_asiz(uint64 tot, uint64 cnt, uint64 siz)
+{
+ if ( (tot == MAIN_SOVF) ||
+      ((siz != 0U) && (cnt > ((MAIN_SOVF - 1U - tot) / siz))) ){ return MAIN_SOVF; }
+ return tot + (cnt * siz);
+}
+
+
+
+/* Writes run statistics into the given file, or onto the standard output if
+** the file name is empty. Files ending with ".csv" get CSV, anything else
+** JSON. */
+
+void main_stats(char const* fnam)
+{
+ FILE* f_sta = stdout;
+ auint csv = 0U;
+ auint len = strlen(fnam);
+
+ if (len != 0U){
+  if ((len >= 4U) && (strcmp(&(fnam[len - 4U]), ".csv") == 0)){ csv = 1U; }
+  f_sta = fopen(fnam, "w");
+  if (f_sta == NULL){
+   perror("Could not open statistics file");
+   return;
+  }
+ }
+
+ if (!istat_write(f_sta, csv)){
+  fprintf(stderr, "Statistics are not compiled in (build with STATS=yes)\n");
+ }
+
+ if (f_sta != stdout){
+  if (fclose(f_sta)){ perror("Could not close statistics file"); }
+ }
+}
+
+
+
 /* Main */
 
 int main(int argc, char** argv)
 {
- FILE* f_inp;
- FILE* f_out;
  auint par_w;
  auint par_h;
- auint par_c;
+ auint par_c[MAIN_CMAX];
+ auint par_n;
  auint par_b;
  auint par_d;
+ auint par_vb[MAIN_VMAX];
+ auint par_vd[MAIN_VMAX];
+ auint par_vn;
+ auint v;
+ auint par_x;
+ auint par_t;
+ auint par_k;
+ auint par_y;
+ auint par_a;
+ auint par_tl[3];
+ auint par_dd[2];
+ char const* par_s;
+ char const* par_hc;
+ char const* par_rc;
+ char const* par_sd;
+ char const* par_fp;
+ char const* par_fl;
+ char const* par_ml;
+ auint par_m;
+ char* i_nam[MAIN_IMAX];
+ char* i_out[MAIN_IMAX];
+ auint i_w[MAIN_IMAX];
+ auint i_h[MAIN_IMAX];
+ auint i_px;
+ uint64 i_tp;
+ auint i_bpp;
+ auint i_dp;
+ auint i_dt;
+ auint i_ol;
+ auint i_cur;
+ auint par_q;
+ auint* prv_buf;
+ auint* prv_wrk;
+ auint* u_tmp;
+ auint m;
+ uint8* l_buf = NULL;
+ auint  l_len;
+ auint par_rs;
+ auint p_rdy;
+ auint v_rdy;
+ auint c_hit;
+ auint e_fit;
+ char const* o_val;
+ main_prs_t  prs;
+ asint i;
+ auint j;
+ auint k;
  void* tptr;
- uint8* img_buf;
- uint8* img_wrk;
+ auint* img_buf;
+ auint* img_wrk;
+ auint* d_buf;
+ auint* d_wrk;
+ auint* d_uni;
+ auint  d_cnt = 0U;
+ uint64 t_siz;
+ auint  d_img = MAIN_IMAX;
+ auint* a_buf;
+ auint* a_wrk;
+ auint  a_w;
+ auint  a_h;
+ uint8* img_raw;
+ char*  o_nam;
+ char*  h_nam;
  iquant_pal_t pal;
- size_t s_tmp;
+ iquant_pal_t spal;
+ iquant_pal_t mpal;
+ iquant_pal_t epal;
+ iquant_pal_t opal[MAIN_CMAX];
+ iquant_pal_t tpal[TILEPAL_GMAX];
+ void*  t_ptr;
+ uint8* t_pal;
+ uint8* t_map;
+ uint8* t_idx;
+ uint64 h_tmp;
+ uint64 r_key = 0U;
+ uint64 h_key = 0U;
+ char   h_str[17];
+ char   o_sfx[32];
+ double t_bud[4];
 
  /* Welcome message */
 
@@ -109,36 +579,232 @@ int main(int argc, char** argv)
 
  if (argc <= 5){
   printf("Needs at least 5 parameters:\n\n");
-  printf("- Input file name (.rgb file, as from ImageMagick)\n");
+  printf("- Input file name (.rgb file, as from ImageMagick, or .rgba, see --rgba)\n");
   printf("- Width of the image in pixels\n");
   printf("- Height of the image in pixels\n");
   printf("- Target color count (2 - 256)\n");
   printf("- Output file name (creates new .rgb file)\n");
   printf("- (Optional) Palette bit depth (1 - 8), defaults to 8\n");
-  printf("- (Optional) Request dithering ('d'), defaults to disabled\n");
+  printf("- (Optional) Request dithering ('d'), or fast ordered dithering ('o'),\n");
+  printf("  defaults to disabled\n");
+  printf("- (Optional) Options, see below\n");
   printf("The bit depth can also be specified as a 3 digit number to specify different\n");
   printf("bit depths for red, green and blue respectively.\n");
+  printf("Multiple color counts may be given separated by commas (up to %u), then an\n", MAIN_CMAX);
+  printf("output is produced for each, with the color count appended to the file name.\n");
+  printf("\n");
+  printf("Options:\n");
+  printf("--fast, --balanced, --best: Speed / quality preset, defaults to balanced\n");
+  printf("--reduce=n: Depth reduction target color count (%u - %u), input size of\n", 320U, MQUANT_COLS);
+  printf("    the main quantizer pass\n");
+  printf("--iter=a,b,c,d: Rearrangement iterations after splits for up to 16, 32, 64\n");
+  printf("    and above colors (1 - 16)\n");
+  printf("--dstr=a,b,c,d,e: Dithering strengths for up to 8, 16, 32, 64 and above\n");
+  printf("    colors (2 - 16, larger is stronger)\n");
+  printf("--cand=k: Dithering considers only the nearest palette color and\n");
+  printf("    its k-1 nearest neighbors for each pixel (1 - 64). Faster, but no\n");
+  printf("    longer exact.\n");
+  printf("--hybrid=n: Do not dither pixels in busy regions, where the sum of\n");
+  printf("    the color differences in the 2x2 neighborhood is at least n (such as\n");
+  printf("    2048), they get their nearest palette color instead. Faster.\n");
+  printf("--rgba: Input and output files are RGBA (.rgba, as from ImageMagick).\n");
+  printf("    Fully transparent pixels take no part in the palette and are not\n");
+  printf("    remapped, alpha is passed through to the output.\n");
+  printf("--tiles=w,h,n: Tiled mode for targets with per-tile palettes: the\n");
+  printf("    image is split into w x h pixel tiles (1 - 256), which are grouped\n");
+  printf("    into n palettes (1 - %u) of the color count each. Writes the index\n", TILEPAL_GMAX);
+  printf("    plane (.idx), tile map (.map) and palettes (.pal) besides the image.\n");
+  printf("    Flat mapping only, one color count and variant, no caches or shared,\n");
+  printf("    fixed or seed palettes.\n");
+  printf("--dedup=w,h: Split the image into w x h pixel tiles (1 - 256), and\n");
+  printf("    apply the palette only once on identical tiles, such as repeated\n");
+  printf("    sprite cells. Each tile is then dithered on its own.\n");
+  printf("--variants=list: Comma separated list of depths, each optionally followed\n");
+  printf("    by 'd' or 'o' for dithering (such as 8,444d,332o) to produce in one run, with\n");
+  printf("    the variant appended to the output file name. Overrides the depth and\n");
+  printf("    dithering parameters.\n");
+  printf("--hcache[=file]: Keep the depth reduced histogram in a sidecar file (by\n");
+  printf("    default the input file name with .iqh appended), and reuse it in later\n");
+  printf("    runs on the same image\n");
+  printf("--cache=dir: Keep results in a cache directory, and reuse them in later\n");
+  printf("    runs with the same image and parameters\n");
+  printf("--cachesize=MB: Size limit of the result cache, defaults to 64 MB. Least\n");
+  printf("    recently used results are evicted to stay within it.\n");
+  printf("--shared=file: Produce one palette shared by the image of the parameters\n");
+  printf("    and the images of the list file, which has an input file name,\n");
+  printf("    width, height and output file name on each line\n");
+  printf("--sequence: With --shared, the images are frames of an animation, only\n");
+  printf("    the pixels changed from the previous frame are remapped\n");
+  printf("--seed=file: Start from the palette of the given .rgb file (up to 256\n");
+  printf("    colors, such as an output of a previous run), which is faster for\n");
+  printf("    slightly edited images or successive animation frames\n");
+  printf("--palette=file: Map onto the fixed palette of the given .rgb file (up to\n");
+  printf("    256 colors) instead of generating one. The color count is ignored.\n");
+  printf("--lut=file: With --palette, keep the color lookup table in the given file\n");
+  printf("    for reuse in later runs with the same palette\n");
+  printf("--budget=ms: Time budget in milliseconds. When exceeded, the main quantizer\n");
+  printf("    pass refines less to finish sooner. Disables the result cache.\n");
+  printf("--hash: Print digests of the palette and the output image\n");
+  printf("--stats[=file]: Write run statistics as JSON (or as CSV if the file name\n");
+  printf("    ends with .csv), to standard output if no file is given. Requires a\n");
+  printf("    build with STATS=yes.\n");
   exit(1);
  }
 
  par_w = main_sdec(argv[2]);
  par_h = main_sdec(argv[3]);
- par_c = main_sdec(argv[4]);
+ par_n = main_slst(argv[4], &(par_c[0]), MAIN_CMAX);
  par_b = 8U;
  par_d = 0U;
- if (argc > 6){
-  if (argv[6][0] == 'd'){
-   par_d = 1U;
-   if (argc > 7){
-    par_b = main_shex(argv[7]);
-   }
-  }else{
-   par_b = main_shex(argv[6]);
-   if (argc > 7){
-    if (argv[7][0] == 'd'){
-     par_d = 1U;
+ par_vn = 0U;
+ par_x = 0U;
+ par_t = 0U;
+ par_k = 0U;
+ par_y = 0U;
+ par_a = 0U;
+ par_tl[2] = 0U;
+ par_dd[0] = 0U;
+ par_s = NULL;
+ par_hc = NULL;
+ par_rc = NULL;
+ par_sd = NULL;
+ par_fp = NULL;
+ par_fl = NULL;
+ par_ml = NULL;
+ par_q  = 0U;
+ par_rs = 64U;
+ prs   = main_prs[1];
+ for (i = 6; i < argc; i++){
+  if       (argv[i][0] == '-'){
+   if       (main_sopt(argv[i], "--fast") != NULL){
+    prs = main_prs[0];
+   }else if (main_sopt(argv[i], "--balanced") != NULL){
+    prs = main_prs[1];
+   }else if (main_sopt(argv[i], "--best") != NULL){
+    prs = main_prs[2];
+   }else if ((o_val = main_sopt(argv[i], "--reduce")) != NULL){
+    prs.drc = main_sdec(o_val);
+    prs.nam = "custom";
+    if ((prs.drc < 320U) || (prs.drc > MQUANT_COLS)){
+     fprintf(stderr, "Reduction target must be between %u and %u (%u)\n", 320U, MQUANT_COLS, prs.drc);
+     exit(1);
+    }
+   }else if ((o_val = main_sopt(argv[i], "--iter")) != NULL){
+    prs.nam = "custom";
+    if ( (main_slst(o_val, &(prs.itr[0]), 4U) != 4U) ||
+         (prs.itr[0] < 1U) || (prs.itr[0] > 16U) ||
+         (prs.itr[1] < 1U) || (prs.itr[1] > 16U) ||
+         (prs.itr[2] < 1U) || (prs.itr[2] > 16U) ||
+         (prs.itr[3] < 1U) || (prs.itr[3] > 16U) ){
+     fprintf(stderr, "Rearrangement iterations need 4 values between 1 and 16 (%s)\n", o_val);
+     exit(1);
+    }
+   }else if ((o_val = main_sopt(argv[i], "--dstr")) != NULL){
+    prs.nam = "custom";
+    if ( (main_slst(o_val, &(prs.dst[0]), 5U) != 5U) ||
+         (prs.dst[0] < 2U) || (prs.dst[0] > 16U) ||
+         (prs.dst[1] < 2U) || (prs.dst[1] > 16U) ||
+         (prs.dst[2] < 2U) || (prs.dst[2] > 16U) ||
+         (prs.dst[3] < 2U) || (prs.dst[3] > 16U) ||
+         (prs.dst[4] < 2U) || (prs.dst[4] > 16U) ){
+     fprintf(stderr, "Dithering strengths need 5 values between 2 and 16 (%s)\n", o_val);
+     exit(1);
+    }
+   }else if ((o_val = main_sopt(argv[i], "--cand")) != NULL){
+    par_k = main_sdec(o_val);
+    if ((par_k == 0U) || (par_k > 64U)){
+     fprintf(stderr, "Candidate count must be between 1 and 64 (%s)\n", o_val);
+     exit(1);
+    }
+   }else if ((o_val = main_sopt(argv[i], "--hybrid")) != NULL){
+    par_y = main_sdec(o_val);
+    if (par_y == 0U){
+     fprintf(stderr, "Hybrid dithering threshold must be at least 1 (%s)\n", o_val);
+     exit(1);
+    }
+   }else if (main_sopt(argv[i], "--rgba") != NULL){
+    par_a = 1U;
+   }else if ((o_val = main_sopt(argv[i], "--tiles")) != NULL){
+    if ( (main_slst(o_val, &(par_tl[0]), 3U) != 3U) ||
+         (par_tl[0] < 1U) || (par_tl[0] > 256U) ||
+         (par_tl[1] < 1U) || (par_tl[1] > 256U) ||
+         (par_tl[2] < 1U) || (par_tl[2] > TILEPAL_GMAX) ){
+     fprintf(stderr, "Tiles need width and height (1 - 256) and palette count (1 - %u) (%s)\n", TILEPAL_GMAX, o_val);
+     exit(1);
+    }
+   }else if ((o_val = main_sopt(argv[i], "--dedup")) != NULL){
+    if ( (main_slst(o_val, &(par_dd[0]), 2U) != 2U) ||
+         (par_dd[0] < 1U) || (par_dd[0] > 256U) ||
+         (par_dd[1] < 1U) || (par_dd[1] > 256U) ){
+     fprintf(stderr, "Dedup tiles need width and height (1 - 256) (%s)\n", o_val);
+     exit(1);
     }
+   }else if ((o_val = main_sopt(argv[i], "--variants")) != NULL){
+    par_vn = main_svar(o_val, &(par_vb[0]), &(par_vd[0]), MAIN_VMAX);
+    if (par_vn == 0U){
+     fprintf(stderr, "Invalid variant list (%s)\n", o_val);
+     exit(1);
+    }
+   }else if (main_sopt(argv[i], "--hcache") != NULL){
+    par_hc = main_sopt(argv[i], "--hcache");
+   }else if ((o_val = main_sopt(argv[i], "--cachesize")) != NULL){
+    par_rs = main_sdec(o_val);
+    if ((par_rs == 0U) || (par_rs > 1048576U)){
+     fprintf(stderr, "Result cache size must be between 1 and 1048576 MB (%s)\n", o_val);
+     exit(1);
+    }
+   }else if ((o_val = main_sopt(argv[i], "--cache")) != NULL){
+    par_rc = o_val;
+    if (par_rc[0] == 0){
+     fprintf(stderr, "Result cache needs a directory\n");
+     exit(1);
+    }
+   }else if ((o_val = main_sopt(argv[i], "--shared")) != NULL){
+    par_ml = o_val;
+    if (par_ml[0] == 0){
+     fprintf(stderr, "Shared palette mode needs an image list file\n");
+     exit(1);
+    }
+   }else if (main_sopt(argv[i], "--sequence") != NULL){
+    par_q = 1U;
+   }else if ((o_val = main_sopt(argv[i], "--palette")) != NULL){
+    par_fp = o_val;
+    if (par_fp[0] == 0){
+     fprintf(stderr, "Fixed palette needs a file\n");
+     exit(1);
+    }
+   }else if ((o_val = main_sopt(argv[i], "--lut")) != NULL){
+    par_fl = o_val;
+    if (par_fl[0] == 0){
+     fprintf(stderr, "Lookup table needs a file\n");
+     exit(1);
+    }
+   }else if ((o_val = main_sopt(argv[i], "--seed")) != NULL){
+    par_sd = o_val;
+    if (par_sd[0] == 0){
+     fprintf(stderr, "Seed palette needs a file\n");
+     exit(1);
+    }
+   }else if ((o_val = main_sopt(argv[i], "--budget")) != NULL){
+    par_t = main_sdec(o_val);
+    if (par_t == 0U){
+     fprintf(stderr, "Time budget must be at least 1 ms (%s)\n", o_val);
+     exit(1);
+    }
+   }else if (main_sopt(argv[i], "--hash") != NULL){
+    par_x = 1U;
+   }else if (main_sopt(argv[i], "--stats") != NULL){
+    par_s = main_sopt(argv[i], "--stats");
+   }else{
+    fprintf(stderr, "Unknown option (%s)\n", argv[i]);
+    exit(1);
    }
+  }else if (argv[i][0] == 'd'){
+   par_d = 1U;
+  }else if (argv[i][0] == 'o'){
+   par_d = 2U;
+  }else{
+   par_b = main_shex(argv[i]);
   }
  }
 
@@ -150,57 +816,213 @@ int main(int argc, char** argv)
   fprintf(stderr, "Invalid height (%u)\n", par_h);
   exit(1);
  }
- if ((par_c  < 2U) || (par_c > 256U)){
-  fprintf(stderr, "Invalid color count (%u)\n", par_c);
+ if (par_n == 0U){
+  fprintf(stderr, "Invalid color count (%s)\n", argv[4]);
   exit(1);
  }
- if ( ( (par_b <     1U) || (par_b >     8U) ) &&
-      ( (par_b < 0x111U) || (par_b > 0x888U) ||
-        ((par_b & 0xFU) > 0x8U) || ((par_b & 0xFFU) > 0x88U) ||
-        ((par_b & 0xFU) < 0x1U) || ((par_b & 0xFFU) < 0x11U) ) ){
+ for (j = 0U; j < par_n; j++){
+  if ((par_c[j]  < 2U) || (par_c[j] > 256U)){
+   fprintf(stderr, "Invalid color count (%u)\n", par_c[j]);
+   exit(1);
+  }
+ }
+ if (!main_cdep(par_b)){
   fprintf(stderr, "Bit depth must be between 1 and 8 or must be a 3 digit number (%u)\n", par_b);
   exit(1);
  }
 
- f_inp = fopen(argv[1], "rb");
- if (f_inp == NULL){
-  perror("Could not open input file");
-  exit(1);
+ /* Sort color counts into increasing order, dropping duplicates */
+
+ for (j = 1U; j < par_n; j++){
+  k = par_c[j];
+  i = (asint)(j) - 1;
+  while ((i >= 0) && (par_c[i] > k)){
+   par_c[i + 1] = par_c[i];
+   i --;
+  }
+  par_c[i + 1] = k;
  }
+ k = 1U;
+ for (j = 1U; j < par_n; j++){
+  if (par_c[j] != par_c[k - 1U]){
+   par_c[k] = par_c[j];
+   k ++;
+  }
+ }
+ par_n = k;
 
- f_out = fopen(argv[5], "wb");
- if (f_out == NULL){
-  perror("Could not open output file");
-  fclose(f_inp);
+ /* The image given by the parameters is the first (and normally only) image
+ ** to process. Shared palette mode adds the images of the list. */
+
+ i_nam[0] = argv[1];
+ i_w[0]   = par_w;
+ i_h[0]   = par_h;
+ i_out[0] = argv[5];
+ par_m    = 1U;
+ if (par_ml != NULL){
+  l_buf = main_rfile(par_ml, &l_len);
+  if (l_buf == NULL){
+   fprintf(stderr, "Could not load image list %s\n", par_ml);
+   exit(1);
+  }
+  par_m += main_sinp((char*)(l_buf), &(i_nam[1]), &(i_w[1]), &(i_h[1]), &(i_out[1]), MAIN_IMAX - 1U);
+  if (par_m == 1U){
+   fprintf(stderr, "Invalid or empty image list (up to %u images) %s\n", MAIN_IMAX - 1U, par_ml);
+   free(l_buf);
+   exit(1);
+  }
+  if ((par_rc != NULL) || (par_hc != NULL)){
+   fprintf(stderr, "Caches are not supported in shared palette mode\n");
+   free(l_buf);
+   exit(1);
+  }
+ }
+ if (par_fp != NULL){
+  if ((par_n > 1U) || (par_vn != 0U) || (par_sd != NULL)){
+   fprintf(stderr, "Fixed palette can not be used with multiple color counts, variants or seed\n");
+   exit(1);
+  }
+ }else if (par_fl != NULL){
+  fprintf(stderr, "Lookup table needs a fixed palette (--palette)\n");
+  exit(1);
+ }
+ if (par_tl[2] != 0U){
+  if ( (par_m > 1U) || (par_fp != NULL) || (par_sd != NULL) ||
+       (par_rc != NULL) || (par_hc != NULL) ||
+       (par_n > 1U) || (par_vn > 1U) ||
+       ((par_vn == 0U) && (par_d != 0U)) || ((par_vn != 0U) && (par_vd[0] != 0U)) ){
+   fprintf(stderr, "Tiled mode only supports flat mapping, one color count and one variant,\n");
+   fprintf(stderr, "without caches, shared, fixed or seed palettes\n");
+   free(l_buf);
+   exit(1);
+  }
+  if (tilepal_cnt(par_w, par_h, par_tl[0], par_tl[1]) > TILEPAL_TMAX){
+   fprintf(stderr, "Too many tiles (at most %u)\n", TILEPAL_TMAX);
+   exit(1);
+  }
+ }
+ if ((par_dd[0] != 0U) && ((par_q) || (par_tl[2] != 0U))){
+  fprintf(stderr, "Dedup can not be used in sequence or tiled mode\n");
+  free(l_buf);
+  exit(1);
+ }
+ if ((par_q) && (par_m == 1U)){
+  fprintf(stderr, "Sequence mode needs an image list (--shared)\n");
   exit(1);
  }
+ i_px = 0U;
+ i_tp = 0U;
+ i_ol = 0U;
+ i_dp = 0U;
+ i_dt = 0U;
+ for (m = 0U; m < par_m; m++){
+  if ( (i_w[m] == 0U) || (i_w[m] > 16384U) ||
+       (i_h[m] == 0U) || (i_h[m] > 16384U) ){
+   fprintf(stderr, "Invalid dimensions (%u x %u) for %s\n", i_w[m], i_h[m], i_nam[m]);
+   free(l_buf);
+   exit(1);
+  }
+  if ((i_w[m] * i_h[m]) > i_px){ i_px = i_w[m] * i_h[m]; }
+  i_tp += i_w[m] * i_h[m];
+  if (i_tp > MAIN_PMAX){
+   fprintf(stderr, "Too many pixels in the shared images (at most %u)\n", MAIN_PMAX);
+   free(l_buf);
+   exit(1);
+  }
+  if (strlen(i_out[m])  > i_ol){ i_ol = strlen(i_out[m]); }
+  if (par_dd[0] != 0U){ /* Dedup: tile count and atlas size */
+   k = tilepal_cnt(i_w[m], i_h[m], par_dd[0], par_dd[1]);
+   if (k > TILEPAL_TMAX){
+    fprintf(stderr, "Too many dedup tiles (at most %u) for %s\n", TILEPAL_TMAX, i_nam[m]);
+    free(l_buf);
+    exit(1);
+   }
+   if (k > i_dt){ i_dt = k; }
+   if ((k * par_dd[0] * par_dd[1]) > i_dp){ i_dp = k * par_dd[0] * par_dd[1]; }
+  }
+ }
 
- /* Convert bit depth to specify R:G:B bits */
+ /* Without a variant list the depth and dithering parameters make the only
+ ** variant. Convert bit depths to specify R:G:B bits. */
 
- if (par_b <= 8U){ par_b = par_b | (par_b << 4) | (par_b << 8); }
+ if (par_vn == 0U){
+  par_vb[0] = par_b;
+  par_vd[0] = par_d;
+  par_vn    = 1U;
+ }
+ for (v = 0U; v < par_vn; v++){
+  if (par_vb[v] <= 8U){ par_vb[v] = par_vb[v] | (par_vb[v] << 4) | (par_vb[v] << 8); }
+ }
+
+ i_bpp = (par_a) ? 4U : 3U;
+
+ /* Time budget starts when beginning to process the image */
+
+ t_bud[0] = itime_get();
+ if (par_t != 0U){
+  mquant_setbudget(t_bud[0] + ((double)(par_t) / 1000.0));
+ }
 
- /* Attempt to allocate buffers, and load the input file in it. */
+ /* Attempt to allocate buffers, and load the input file in it. Image
+ ** buffers are sized for the largest image, the merge palette is only
+ ** needed in shared palette mode, the previous frame's planes in sequence
+ ** mode, the tile atlas planes in dedup mode. The stages work on image planes (one 32 bit element for every
+ ** pixel), the packed buffer is for the files and the result cache. In RGBA
+ ** mode the packed buffer also carries the alpha through to the output. */
 
- tptr = malloc( (par_w * par_h * 3U) +
-                (par_w * par_h * 3U) +
-                (sizeof(iquant_col_t) * MQUANT_COLS) );
+ k = (par_m > 1U) ? (MQUANT_COLS * 2U) : 0U;
+ t_siz = main_asiz(0U,    i_px, sizeof(auint) * ((par_q) ? 4U : 2U));
+ t_siz = main_asiz(t_siz, ((uint64)(i_dp) * 2U) + i_dt, sizeof(auint));
+ t_siz = main_asiz(t_siz, MQUANT_COLS + k, sizeof(iquant_col_t));
+ t_siz = main_asiz(t_siz, 256U * (par_n + 2U), sizeof(iquant_col_t));
+ t_siz = main_asiz(t_siz, i_px, i_bpp);
+ t_siz = main_asiz(t_siz, i_ol + sizeof(o_sfx), 1U);
+ t_siz = main_asiz(t_siz, strlen(argv[1]) + 8U, 1U);
+ if (t_siz > (uint64)(SIZE_MAX)){
+  tptr = NULL;
+ }else{
+  tptr = malloc((size_t)(t_siz));
+ }
  if (tptr == NULL){
-  fprintf(stderr, "Couldn't allocate memory for image (%u bytes)\n", par_w * par_h * 3U);
-  fclose(f_inp);
-  fclose(f_out);
+  if (t_siz == MAIN_SOVF){
+   fprintf(stderr, "Couldn't allocate memory for image (too large)\n");
+  }else{
+   fprintf(stderr, "Couldn't allocate memory for image (%llu bytes)\n", (unsigned long long)(t_siz));
+  }
+  free(l_buf);
   exit(1);
  }
+ ISTAT_MEM(t_siz);
  img_buf = (void*)(((uint8*)(tptr)));
- img_wrk = (void*)(((uint8*)(tptr)) + (par_w * par_h * 3U));
- pal.col = (void*)(((uint8*)(tptr)) + (par_w * par_h * 3U) + (par_w * par_h * 3U));
+ img_wrk = img_buf + i_px;
+ prv_buf = img_wrk + i_px;
+ prv_wrk = prv_buf + i_px;
+ d_buf   = prv_buf;
+ d_wrk   = d_buf + i_dp;
+ d_uni   = d_wrk + i_dp;
+ if (par_q){ pal.col = (void*)(prv_wrk + i_px); }
+ else      { pal.col = (void*)(d_uni + i_dt); }
  pal.mct = MQUANT_COLS;
-
- s_tmp = fread(img_buf, 1, par_w * par_h * 3U, f_inp); /* Note: fits in 32 bit unsigned int due to size limits */
- if ((par_w * par_h * 3U) != (auint)(s_tmp)){
-  fprintf(stderr, "Warning: input file size didn't match dimensions! (%u <=> %u size)\n", par_w * par_h * 3U, (auint)(s_tmp));
+ for (j = 0U; j < par_n; j++){
+  opal[j].col = pal.col + MQUANT_COLS + (256U * j);
+  opal[j].mct = 256U;
  }
+ spal.col = pal.col + MQUANT_COLS + (256U * par_n);
+ spal.mct = 256U;
+ epal.col = spal.col + 256U;
+ epal.mct = par_c[par_n - 1U];
+ mpal.col = epal.col + 256U;
+ mpal.mct = k;
+ img_raw = (void*)(mpal.col + k);
+ o_nam   = (void*)(img_raw + (i_px * i_bpp));
+ h_nam   = o_nam + (i_ol + sizeof(o_sfx));
 
- fclose(f_inp); /* Don't care about close error on the input... Not my damn problem */
+ if (!main_load(argv[1], img_raw, img_buf, par_w * par_h, i_bpp)){
+  free(tptr);
+  free(l_buf);
+  exit(1);
+ }
+ i_cur = 0U; /* Image in the buffer */
 
  /* Quantize */
 
@@ -208,35 +1030,496 @@ int main(int argc, char** argv)
  printf("- Input file ..........: %s\n", argv[1]);
  printf("- Width ...............: %u px\n", par_w);
  printf("- Height ..............: %u px\n", par_h);
- printf("- Target color count ..: %u\n", par_c);
+ printf("- Target color count ..: %u", par_c[0]);
+ for (j = 1U; j < par_n; j++){
+  printf(", %u", par_c[j]);
+ }
+ printf("\n");
  printf("- Output file .........: %s\n", argv[5]);
- printf("- Target palette depth : %x R:G:B bits\n", par_b);
- printf("- Dithering request ...: %u\n", par_d);
+ if (par_dd[0] != 0U){
+  printf("- Dedup tiles .........: %u x %u px\n", par_dd[0], par_dd[1]);
+ }
+ if (par_tl[2] != 0U){
+  printf("- Tiles ...............: %u x %u px, %u palettes\n", par_tl[0], par_tl[1], par_tl[2]);
+ }
+ if (par_a){
+  printf("- Alpha channel .......: kept, transparent pixels skipped\n");
+ }
+ if (par_m > 1U){
+  printf("- Shared palette ......: %u images (%s)\n", par_m, par_ml);
+ }
+ if (par_vn > 1U){
+  printf("- Variants ............: %x%s", par_vb[0], main_dnam[par_vd[0]]);
+  for (v = 1U; v < par_vn; v++){
+   printf(", %x%s", par_vb[v], main_dnam[par_vd[v]]);
+  }
+  printf("\n");
+ }else{
+  printf("- Target palette depth : %x R:G:B bits\n", par_vb[0]);
+  printf("- Dithering request ...: %u\n", par_vd[0]);
+ }
+ printf("- Preset ..............: %s\n", prs.nam);
+ printf("- Reduction target ....: %u colors\n", prs.drc);
+ printf("- Rearrange iterations : %u/%u/%u/%u\n", prs.itr[0], prs.itr[1], prs.itr[2], prs.itr[3]);
+ printf("- Dithering strengths .: %u/%u/%u/%u/%u\n", prs.dst[0], prs.dst[1], prs.dst[2], prs.dst[3], prs.dst[4]);
+ if (par_k != 0U){
+  printf("- Dither candidates ...: %u\n", par_k);
+ }
+ if (par_y != 0U){
+  printf("- Hybrid dithering ....: from %u\n", par_y);
+ }
+ if (par_t != 0U){
+  printf("- Time budget .........: %u ms\n", par_t);
+ }
  printf("\n");
 
- depthred(img_buf, par_w * par_h, &pal, MQUANT_COLS);
- mquant(&pal, par_c, par_b);
- if (par_d){
-  palapp_dither(img_buf, img_wrk, par_w, par_h, &pal);
- }else{
-  palapp_flat  (img_buf, img_wrk, par_w, par_h, &pal);
+ mquant_setitr(&(prs.itr[0]));
+ spal.cct = 0U;
+ if (par_sd != NULL){
+  if (!main_lpal(par_sd, &spal, i_bpp)){
+   free(tptr);
+   free(l_buf);
+   exit(1);
+  }
+  printf("Seed palette: %u colors from %s\n", spal.cct, par_sd);
+  mquant_setseed(&spal);
+ }
+ if (par_fp != NULL){
+  if ( (!main_lpal(par_fp, &spal, i_bpp)) ||
+       (!palut_init(&spal, par_fl)) ){
+   free(tptr);
+   free(l_buf);
+   exit(1);
+  }
+  printf("Fixed palette: %u colors from %s\n", spal.cct, par_fp);
  }
+ palapp_setdst(&(prs.dst[0]));
+ palapp_setcand(par_k);
+ palapp_sethybrid(par_y);
 
- /* Write back, clean up and exit */
+ /* Open the result cache. Its keys cover the input image, the program
+ ** version and every parameter affecting the results. With a time budget
+ ** the results depend on the speed of the run, so they are not cached. */
 
- s_tmp = fwrite(img_wrk, 1, par_w * par_h * 3U, f_out); /* Note: fits in 32 bit unsigned int due to size limits */
- if ((par_w * par_h * 3U) != (auint)(s_tmp)){
-  fprintf(stderr, "Warning: output file didn't accept the whole image! (%u <=> %u size)\n", par_w * par_h * 3U, (auint)(s_tmp));
+ if ((par_rc != NULL) && (par_t != 0U)){
+  fprintf(stderr, "Warning: result cache is not used with a time budget\n");
+  par_rc = NULL;
+ }
+ if (par_rc != NULL){
+  if (!icache_ropen(par_rc, (uint64)(par_rs) << 20)){
+   fprintf(stderr, "Warning: could not open result cache %s\n", par_rc);
+   par_rc = NULL;
+  }
+  r_key = ihash_buf(IHASH_INIT, IQUANT_VERSION, strlen(IQUANT_VERSION));
+  r_key = ihash_buf(r_key, img_raw, par_w * par_h * i_bpp);
+  r_key = ihash_val(r_key, par_w);
+  r_key = ihash_val(r_key, par_h);
+  r_key = ihash_val(r_key, prs.drc);
+  for (k = 0U; k < 4U; k++){ r_key = ihash_val(r_key, prs.itr[k]); }
+  for (k = 0U; k < 5U; k++){ r_key = ihash_val(r_key, prs.dst[k]); }
+  if (par_k != 0U){ r_key = ihash_val(r_key, 0xCA4DU + par_k); } /* Approximate dithering */
+  if (par_y != 0U){ r_key = ihash_val(r_key, 0x4B1DU + par_y); } /* Hybrid dithering */
+  if (par_fp != NULL){ r_key = ihash_val(r_key, 0xF1CEDU); } /* Fixed, not seed */
+  if (par_dd[0] != 0U){ /* Dedup tiles */
+   r_key = ihash_val(r_key, 0xDED0U + par_dd[0]);
+   r_key = ihash_val(r_key, par_dd[1]);
+  }
+  for (k = 0U; k < spal.cct; k++){ r_key = ihash_val(r_key, spal.col[k].col); }
  }
 
- free(img_buf);
+ /* Exact fit: collect the colors of the image if it has no more than the
+ ** largest color count requested. Giving up on an image with more colors
+ ** is quick. */
+
+ epal.cct = 0U;
+ if ((par_m == 1U) && (par_fp == NULL) && (par_tl[2] == 0U)){
+  if (!palgen_exact(img_buf, par_w * par_h, &epal)){ epal.cct = 0U; }
+ }
+
+ /* Key of the histogram sidecar. It only depends on the image and the
+ ** reduction target. Calculated here, as the packed buffer is later reused
+ ** for the results. */
+
+ if (par_hc != NULL){
+  h_key = ihash_buf(IHASH_INIT, img_raw, par_w * par_h * i_bpp);
+  h_key = ihash_val(h_key, par_w);
+  h_key = ihash_val(h_key, par_h);
+  h_key = ihash_val(h_key, prs.drc);
+ }
+
+ t_bud[1] = itime_get() - t_bud[0]; /* Accumulates load & depth red. time */
+ t_bud[2] = 0.0;                    /* Accumulates main quantizer pass time */
+ t_bud[3] = 0.0;                    /* Accumulates palette application time */
+
+ /* Tiled mode: palettes for groups of tiles, then every tile mapped by its
+ ** group's palette. Besides the image, the index plane, the tile map and the
+ ** palettes are written. */
+
+ if (par_tl[2] != 0U){
+
+  k = tilepal_cnt(par_w, par_h, par_tl[0], par_tl[1]);
+  t_siz = main_asiz(0U,    256U * par_tl[2], sizeof(iquant_col_t));
+  t_siz = main_asiz(t_siz, 256U * par_tl[2], 3U);
+  t_siz = main_asiz(t_siz, k, 1U);
+  t_siz = main_asiz(t_siz, par_w, par_h);
+  if (t_siz > (uint64)(SIZE_MAX)){
+   t_ptr = NULL;
+  }else{
+   t_ptr = malloc((size_t)(t_siz));
+  }
+  if (t_ptr == NULL){
+   fprintf(stderr, "Couldn't allocate memory for tiles\n");
+   free(tptr);
+   exit(1);
+  }
+  ISTAT_MEM(t_siz);
+  for (j = 0U; j < par_tl[2]; j++){
+   tpal[j].col = (iquant_col_t*)(t_ptr) + (256U * j);
+   tpal[j].mct = 256U;
+  }
+  t_pal = (void*)(tpal[0].col + (256U * par_tl[2]));
+  t_map = t_pal + (256U * 3U * par_tl[2]);
+  t_idx = t_map + k;
+
+  t_bud[2] -= itime_get();
+  ISTAT_BEG(ISTAT_S_MQUANT);
+  tilepal(img_buf, img_wrk, par_w, par_h, par_tl[0], par_tl[1],
+          &pal, prs.drc, par_c[0], par_vb[0], &(tpal[0]), par_tl[2], t_map);
+  ISTAT_END(ISTAT_S_MQUANT);
+  t_bud[2] += itime_get();
+
+  t_bud[3] -= itime_get();
+  ISTAT_BEG(ISTAT_S_PALAPP);
+  tilepal_apply(img_buf, img_wrk, t_idx, par_w, par_h, par_tl[0], par_tl[1],
+                &(tpal[0]), t_map);
+  if (par_a){ idata_pack_rgba(img_wrk, img_raw, par_w * par_h); }
+  else      { idata_pack(img_wrk, img_raw, par_w * par_h); }
+  ISTAT_END(ISTAT_S_PALAPP);
+  t_bud[3] += itime_get();
+
+  /* The palettes file holds the palette of each group, padded with black to
+  ** the color count */
+
+  memset(t_pal, 0U, par_c[0] * 3U * par_tl[2]);
+  for (j = 0U; j < par_tl[2]; j++){
+   for (m = 0U; m < tpal[j].cct; m++){
+    t_pal[(((par_c[0] * j) + m) * 3U) + 0U] = (tpal[j].col[m].col >> 16) & 0xFFU;
+    t_pal[(((par_c[0] * j) + m) * 3U) + 1U] = (tpal[j].col[m].col >>  8) & 0xFFU;
+    t_pal[(((par_c[0] * j) + m) * 3U) + 2U] = (tpal[j].col[m].col      ) & 0xFFU;
+   }
+  }
+
+  if (par_x){
+   h_tmp = ihash_buf(IHASH_INIT, t_pal, par_c[0] * 3U * par_tl[2]);
+   ihash_str(h_tmp, h_str);
+   printf("Palette digest: %s\n", h_str);
+   h_tmp = ihash_buf(IHASH_INIT, t_map, k);
+   ihash_str(h_tmp, h_str);
+   printf("Tile map digest: %s\n", h_str);
+   h_tmp = ihash_buf(IHASH_INIT, img_raw, par_w * par_h * i_bpp);
+   ihash_str(h_tmp, h_str);
+   printf("Image digest .: %s\n", h_str);
+  }
+
+  ISTAT_BEG(ISTAT_S_WRITE);
+  printf("Writing %s (and .idx, .map, .pal)\n", argv[5]);
+  c_hit = main_write(argv[5], img_raw, par_w * par_h * i_bpp);
+  strcpy(o_nam, argv[5]);
+  strcat(o_nam, ".idx");
+  c_hit = c_hit && main_write(o_nam, t_idx, par_w * par_h);
+  strcpy(o_nam, argv[5]);
+  strcat(o_nam, ".map");
+  c_hit = c_hit && main_write(o_nam, t_map, k);
+  strcpy(o_nam, argv[5]);
+  strcat(o_nam, ".pal");
+  c_hit = c_hit && main_write(o_nam, t_pal, par_c[0] * 3U * par_tl[2]);
+  free(t_ptr);
+  if (!c_hit){
+   free(tptr);
+   exit(1);
+  }
+  ISTAT_END(ISTAT_S_WRITE);
+
+ }else{
+
+  /* Quantize for each variant, apply each palette and write out the
+  ** results. The stages are only carried out when some result is missing
+  ** from the result cache. */
+
+  p_rdy = 0U;
+  if (par_fp != NULL){ /* Fixed palette: no quantization needed */
+   opal[0].cct = spal.cct;
+   opal[0].ocs = 0U;
+   memcpy(opal[0].col, spal.col, sizeof(iquant_col_t) * spal.cct);
+   p_rdy = 1U;
+  }
+
+  for (v = 0U; v < par_vn; v++){
+
+   v_rdy = (par_fp != NULL); /* Nothing to quantize for a fixed palette */
+
+   for (j = 0U; j < par_n; j++){
+
+    c_hit = 0U;
+    if (par_rc != NULL){
+     h_tmp = ihash_val(r_key, par_c[j]);
+     h_tmp = ihash_val(h_tmp, par_vb[v]);
+     h_tmp = ihash_val(h_tmp, par_vd[v]);
+     c_hit = icache_rget(h_tmp, &(opal[j]), img_raw, par_w * par_h * i_bpp);
+    }
+
+    /* Exact fit: if the colors of the image fit in the color count and are
+    ** of the palette depth, they make the palette, and the image is its
+    ** own result. Nothing to quantize or map. */
+
+    e_fit = (epal.cct != 0U) && (epal.cct <= par_c[j]);
+    for (k = 0U; (e_fit) && (k < epal.cct); k++){
+     e_fit = (coldepth_d(epal.col[k].col, par_vb[v]) == epal.col[k].col);
+    }
+    if ((!c_hit) && (e_fit)){
+     opal[j].cct = epal.cct;
+     opal[j].ocs = epal.ocs;
+     memcpy(opal[j].col, epal.col, sizeof(iquant_col_t) * epal.cct);
+    }
+
+    if ((!c_hit) && (!e_fit)){
+
+     /* Depth reduction, or loading its result from the histogram sidecar.
+     ** It only depends on the image and the reduction target. */
+
+     if (!p_rdy){
+      t_bud[1] -= itime_get();
+      ISTAT_BEG(ISTAT_S_DEPTHRED);
+      pal.cct = 0U;
+      if (par_hc != NULL){
+       if (par_hc[0] == 0){
+        strcpy(h_nam, argv[1]);
+        strcat(h_nam, ".iqh");
+        par_hc = h_nam;
+       }
+       if (icache_hload(par_hc, h_key, &pal)){
+        printf("Depth reduction: Loaded %u colors from %s\n", pal.cct, par_hc);
+       }
+      }
+      if (par_m > 1U){
+       /* Shared palette: merge the histograms of all images, streaming
+       ** them through the image buffer */
+       mpal.cct = 0U;
+       mpal.ocs = 0U;
+       for (m = 0U; m < par_m; m++){
+        if (i_cur != m){
+         if (!main_load(i_nam[m], img_raw, img_buf, i_w[m] * i_h[m], i_bpp)){
+          free(tptr);
+          free(l_buf);
+          exit(1);
+         }
+         i_cur = m;
+        }
+        main_dred(img_buf, img_wrk, i_w[m] * i_h[m], par_a, &pal, prs.drc);
+        depthred_merge(&mpal, &pal, prs.drc);
+       }
+       pal.cct = mpal.cct;
+       pal.ocs = mpal.ocs;
+       memcpy(pal.col, mpal.col, sizeof(iquant_col_t) * mpal.cct);
+      }
+      if (pal.cct == 0U){
+       main_dred(img_buf, img_wrk, par_w * par_h, par_a, &pal, prs.drc);
+       if (par_hc != NULL){
+        if (icache_hsave(par_hc, h_key, &pal)){
+         printf("Depth reduction: Saved %u colors into %s\n", pal.cct, par_hc);
+        }else{
+         fprintf(stderr, "Warning: could not write histogram sidecar %s\n", par_hc);
+        }
+       }
+      }
+      ISTAT_END(ISTAT_S_DEPTHRED);
+      t_bud[1] += itime_get();
+      t_bud[2] -= itime_get();
+      ISTAT_BEG(ISTAT_S_MQUANT);
+      mquant_prep(&pal); /* Difference matrix is shared by all variants */
+      ISTAT_END(ISTAT_S_MQUANT);
+      t_bud[2] += itime_get();
+      p_rdy = 1U;
+     }
+
+     if (!v_rdy){
+      t_bud[2] -= itime_get();
+      ISTAT_BEG(ISTAT_S_MQUANT);
+      mquant_multi(&pal, &(par_c[0]), par_n, par_vb[v], &(opal[0]));
+      ISTAT_END(ISTAT_S_MQUANT);
+      t_bud[2] += itime_get();
+      v_rdy = 1U;
+     }
+
+    }
+
+    /* Apply the palette to every image (only one unless in shared palette
+    ** mode, when they are streamed through the image buffer) */
+
+    for (m = 0U; m < par_m; m++){
+
+     if (!c_hit){
+
+      if (i_cur != m){
+       t_bud[1] -= itime_get();
+       if (par_q){ /* Keep previous frame */
+        u_tmp   = prv_buf;
+        prv_buf = img_buf;
+        img_buf = u_tmp;
+       }
+       if (!main_load(i_nam[m], img_raw, img_buf, i_w[m] * i_h[m], i_bpp)){
+        free(tptr);
+        free(l_buf);
+        exit(1);
+       }
+       i_cur = m;
+       t_bud[1] += itime_get();
+      }
+
+      t_bud[3] -= itime_get();
+      ISTAT_BEG(ISTAT_S_PALAPP);
+      if (e_fit){ /* Exact fit: lossless */
+       printf("Exact fit: %u colors, image kept lossless\n", epal.cct);
+       memcpy(img_wrk, img_buf, sizeof(auint) * i_w[m] * i_h[m]);
+      }else if (par_q){ /* Sequence: remap only what changed since the previous frame */
+       u_tmp   = prv_wrk;
+       prv_wrk = img_wrk;
+       img_wrk = u_tmp;
+       u_tmp   = prv_buf;
+       if ((m == 0U) || (i_w[m] != i_w[m - 1U]) || (i_h[m] != i_h[m - 1U])){ u_tmp = NULL; }
+       if       (par_vd[v] == 1U){
+        palapp_dither_seq(img_buf, img_wrk, i_w[m], i_h[m], &(opal[j]), u_tmp, prv_wrk);
+       }else if (par_vd[v] == 2U){
+        palapp_ordered   (img_buf, img_wrk, i_w[m], i_h[m], &(opal[j]));
+       }else{
+        palapp_flat_seq  (img_buf, img_wrk, i_w[m], i_h[m], &(opal[j]), u_tmp, prv_wrk);
+       }
+      }else{
+       a_buf = img_buf;
+       a_wrk = img_wrk;
+       a_w   = i_w[m];
+       a_h   = i_h[m];
+       if (par_dd[0] != 0U){ /* Dedup: process the atlas of unique tiles */
+        if (d_img != m){
+         d_cnt = tilepal_dedup(img_buf, i_w[m], i_h[m], par_dd[0], par_dd[1], d_buf, d_uni);
+         d_img = m;
+        }
+        a_buf = d_buf;
+        a_wrk = d_wrk;
+        a_w   = par_dd[0];
+        a_h   = par_dd[1] * d_cnt;
+       }
+       if       ((par_vd[v] == 1U) && (par_dd[0] != 0U)){
+        palapp_dither_tiles(d_buf, d_wrk, par_dd[0], par_dd[1], d_cnt, &(opal[j]));
+       }else if (par_vd[v] == 1U){
+        palapp_dither  (a_buf, a_wrk, a_w, a_h, &(opal[j]));
+       }else if (par_vd[v] == 2U){
+        palapp_ordered (a_buf, a_wrk, a_w, a_h, &(opal[j]));
+       }else if (par_fp != NULL){
+        palapp_flat_lut(a_buf, a_wrk, a_w, a_h, &(opal[j]));
+       }else{
+        palapp_flat    (a_buf, a_wrk, a_w, a_h, &(opal[j]));
+       }
+       if (par_dd[0] != 0U){
+        tilepal_scatter(d_wrk, img_wrk, i_w[m], i_h[m], par_dd[0], par_dd[1], d_uni);
+       }
+      }
+      if (par_a){ idata_pack_rgba(img_wrk, img_raw, i_w[m] * i_h[m]); }
+      else      { idata_pack(img_wrk, img_raw, i_w[m] * i_h[m]); }
+      ISTAT_END(ISTAT_S_PALAPP);
+      t_bud[3] += itime_get();
+
+      if (par_rc != NULL){
+       h_tmp = ihash_val(r_key, par_c[j]);
+       h_tmp = ihash_val(h_tmp, par_vb[v]);
+       h_tmp = ihash_val(h_tmp, par_vd[v]);
+       if (!icache_rput(h_tmp, &(opal[j]), img_raw, par_w * par_h * i_bpp)){
+        fprintf(stderr, "Warning: could not store result in cache %s\n", par_rc);
+       }
+      }
+
+     }
+
+     o_sfx[0] = 0;
+     if (par_n  > 1U){
+      sprintf(&(o_sfx[strlen(o_sfx)]), "-%u", par_c[j]);
+     }
+     if (par_vn > 1U){
+      sprintf(&(o_sfx[strlen(o_sfx)]), "-%x%s", par_vb[v], main_dnam[par_vd[v]]);
+     }
+     main_onam(o_nam, i_out[m], o_sfx);
+     if (c_hit){
+      printf("Result cache hit for %s\n", o_nam);
+     }
+
+     /* Digests of the results, so they can be compared against known good
+     ** ones when altering the algorithms */
+
+     if (par_x){
+      h_tmp = IHASH_INIT;
+      for (k = 0U; k < opal[j].cct; k++){
+       h_tmp = ihash_val(h_tmp, opal[j].col[k].col);
+      }
+      ihash_str(h_tmp, h_str);
+      printf("Palette digest: %s\n", h_str);
+      h_tmp = ihash_buf(IHASH_INIT, img_raw, i_w[m] * i_h[m] * i_bpp);
+      ihash_str(h_tmp, h_str);
+      printf("Image digest .: %s\n", h_str);
+     }
+
+     /* Write back */
+
+     ISTAT_BEG(ISTAT_S_WRITE);
+     printf("Writing %s\n", o_nam);
+     if (!main_write(o_nam, img_raw, i_w[m] * i_h[m] * i_bpp)){
+      if (par_rc != NULL){ icache_rclose(); }
+      free(tptr);
+      free(l_buf);
+      exit(1);
+     }
+     ISTAT_END(ISTAT_S_WRITE);
+
+    }
+
+   }
+
+  }
 
- if (fclose(f_out)){
-  perror("Could not close output file");
-  exit(1);
  }
 
+ if (par_rc != NULL){
+  icache_rclose();
+ }
+ if (par_fp != NULL){
+  if (!palut_free()){
+   fprintf(stderr, "Warning: could not write lookup table %s\n", par_fl);
+  }
+ }
+ if (par_t != 0U){
+  t_bud[0]  = itime_get() - t_bud[0];
+  printf("Time budget use (of %u ms):\n", par_t);
+  printf("- Load & depth red. ...: %8.1f ms (%5.1f%%)\n",
+         t_bud[1] * 1000.0, t_bud[1] * 100000.0 / (double)(par_t));
+  printf("- Main quantizer pass .: %8.1f ms (%5.1f%%)\n",
+         t_bud[2] * 1000.0, t_bud[2] * 100000.0 / (double)(par_t));
+  printf("- Palette application .: %8.1f ms (%5.1f%%)\n",
+         t_bud[3] * 1000.0, t_bud[3] * 100000.0 / (double)(par_t));
+  printf("- Total ...............: %8.1f ms (%5.1f%%)\n",
+         t_bud[0] * 1000.0, t_bud[0] * 100000.0 / (double)(par_t));
+ }
+
+ /* Clean up and exit */
+
+ free(tptr);
+ free(l_buf);
+
  printf("Quantization complete\n");
 
+ /* Run statistics if requested */
+
+ if (par_s != NULL){
+  main_stats(par_s);
+ }
+
  return 0;      /* Proper exit */
 }
@@ -25,9 +25,24 @@
 #include "mquant.h"
 #include "coldiff.h"
 #include "coldepth.h"
+#include "istat.h"
+#include "itime.h"
 
 
 
+/* The palette being quantized, in separate arrays, so the loops going
+** through it only load the fields they use: colors, occurrences and bucket
+** assignments, and the count of colors */
+static auint mquant_pcl[MQUANT_COLS];
+static auint mquant_poc[MQUANT_COLS];
+static auint mquant_pwk[MQUANT_COLS];
+static auint mquant_pct;
+
+/* Precalculated features of the palette's colors for coldiff_hsl(): hue and
+** saturation, and luminosity */
+static auint mquant_phs[MQUANT_COLS];
+static auint mquant_plm[MQUANT_COLS];
+
 /* Average colors (going in the palette) for every bucket */
 static auint mquant_bcl[MQUANT_COLS];
 
@@ -46,20 +61,58 @@ static auint mquant_bxc0[MQUANT_COLS];
 /* Color 1 endpoint if the bucket was to be split (palette index) */
 static auint mquant_bxc1[MQUANT_COLS];
 
+/* Saved bucket assignments, colors and occupations for snapshots */
+static auint mquant_swk[MQUANT_COLS];
+static auint mquant_sbc[MQUANT_COLS];
+static auint mquant_sbo[MQUANT_COLS];
+
+/* Features of the bucket colors for coldiff_hsl(), see mquant_bfeat() */
+static auint mquant_bhs[MQUANT_COLS];
+static auint mquant_blm[MQUANT_COLS];
+
 /* Current bucket count */
 static auint mquant_bct;
 
 /* All of the weighted differences between colors */
 static uint16 mquant_dif[MQUANT_COLS * MQUANT_COLS];
 
+/* Rearrangement iterations after splits by bucket count (up to 16, 32, 64,
+** and above) */
+static auint mquant_itr[4] = {4U, 3U, 2U, 1U};
+
+/* Time budget deadline (as from itime_get), zero if there is no budget */
+static double mquant_dln = 0.0;
+
+/* Seed palette, NULL if the quantizer starts from a single bucket */
+static iquant_pal_t const* mquant_spal = NULL;
+
+/* Limited mode: set when the time budget is exhausted, then the quantizer
+** refines less to finish sooner. */
+static auint mquant_lim;
+
 /* Large floating point number to start search at...
 ** Need to replace to something better. */
 #define FLT_LARGE (1.0e30)
 
 
 
+/* Calculate the features of the bucket colors for coldiff_hsl(). Needs to
+** be done before comparing them with the palette's colors, if they changed
+** since. */
+static void mquant_bfeat(void)
+{
+ auint i;
+
+ for (i = 0U; i < mquant_bct; i++){
+  mquant_bhs[i] = coldiff_hs(mquant_bcl[i]);
+  mquant_blm[i] = coldiff_getlum(mquant_bcl[i]);
+ }
+}
+
+
+
 /* Calculate occurrences for the buckets */
-static void mquant_cocc(iquant_pal_t* pal)
+static void mquant_cocc(void)
 {
  auint i;
 
@@ -71,8 +124,61 @@ static void mquant_cocc(iquant_pal_t* pal)
 
  /* Add up color occurrences */
 
- for (i = 0U; i < (pal->cct); i++){
-  mquant_boc[pal->col[i].wrk] += pal->col[i].occ;
+ for (i = 0U; i < mquant_pct; i++){
+  mquant_boc[mquant_pwk[i]] += mquant_poc[i];
+ }
+}
+
+
+
+/* Re-averages a bucket from the colors assigned to it. However if the color
+** would become equal to any other, the change is avoided. If the bucket has
+** no colors, it is not affected. */
+static void mquant_bavg(auint i, auint pdep)
+{
+ auint  j;
+ auint  t;
+ uint64 r;
+ uint64 g;
+ uint64 b;
+ auint  c;
+
+ r = 0U;
+ g = 0U;
+ b = 0U;
+ c = 0U;
+
+ for (j = 0U; j < mquant_pct; j++){ /* For every color in the bucket 'i' */
+  if (mquant_pwk[j] == i){
+   r += (uint64)((mquant_pcl[j] >> 16) & 0xFFU) * mquant_poc[j];
+   g += (uint64)((mquant_pcl[j] >>  8) & 0xFFU) * mquant_poc[j];
+   b += (uint64)((mquant_pcl[j]      ) & 0xFFU) * mquant_poc[j];
+   c += mquant_poc[j];
+  }
+ }
+
+ if (c != 0U){ /* (The mask with 0xFF shouldn't be necessary) */
+
+  r = ((r + (c >> 1)) / c) & 0xFFU;
+  g = ((g + (c >> 1)) / c) & 0xFFU;
+  b = ((b + (c >> 1)) / c) & 0xFFU;
+  t = coldepth_d((auint)((r << 16) | (g << 8) | (b)), pdep);
+
+  /* Only assign the new color if it is distinct and the bucket's occurrence
+  ** didn't decrease too much. */
+
+  if (c >= ((mquant_boc[i] + 1U) / 2U)){
+   for (j = 0U; j < mquant_bct; j++){
+    if (i != j){
+     if (mquant_bcl[j] == t){ break; }
+    }
+   }
+   if (j == mquant_bct){
+    mquant_bcl[i] = t;
+    mquant_boc[i] = c;
+   }
+  }
+
  }
 }
 
@@ -81,7 +187,7 @@ static void mquant_cocc(iquant_pal_t* pal)
 /* Color rearrangement. This increases the quality of the median cut by that
 ** after the cut, the colors will converge towards the best group suiting
 ** them. */
-static void mquant_rearrange(iquant_pal_t* pal, auint pdep)
+static void mquant_rearrange(auint pdep)
 {
  auint i;
  auint j;
@@ -90,44 +196,48 @@ static void mquant_rearrange(iquant_pal_t* pal, auint pdep)
  auint bxid;
  auint bxvl;
  auint t;
- auint r;
- auint g;
- auint b;
- auint c;
  auint itr;
 
- if      (mquant_bct <= 16U){ itr = 4U; }
- else if (mquant_bct <= 32U){ itr = 3U; }
- else if (mquant_bct <= 64U){ itr = 2U; }
- else                       { itr = 1U; }
+ if      (mquant_bct <= 16U){ itr = mquant_itr[0]; }
+ else if (mquant_bct <= 32U){ itr = mquant_itr[1]; }
+ else if (mquant_bct <= 64U){ itr = mquant_itr[2]; }
+ else                       { itr = mquant_itr[3]; }
+ if      (mquant_lim){ itr = 1U; }
+
+ ISTAT_INC(ISTAT_MQ_REARR);
 
  /* Make sure occurrences are calculated */
 
- mquant_cocc(pal);
+ mquant_cocc();
 
  /* Try some iterations of rearrangement */
 
  for (k = 0U; k < itr; k++){
 
+  ISTAT_INC(ISTAT_MQ_RITR);
+
   /* Re-arrange colors to nearest buckets */
 
   rei = 0U; /* Indicates whether anything was changed */
 
-  for (i = 0U; i < (pal->cct); i++){
+  mquant_bfeat();
+
+  for (i = 0U; i < mquant_pct; i++){
 
    bxid = 0U;
    bxvl = 0xFFFFFFFFU;
 
    for (j = 0U; j < mquant_bct; j++){
-    t = coldiff(pal->col[i].col, mquant_bcl[j]);
+    t = coldiff_hsl(mquant_pcl[i], mquant_phs[i], mquant_plm[i],
+                    mquant_bcl[j], mquant_bhs[j], mquant_blm[j]);
     if (t < bxvl){
      bxvl = t;
      bxid = j;
     }
    }
 
-   if (pal->col[i].wrk != bxid){
-    pal->col[i].wrk = bxid;
+   if (mquant_pwk[i] != bxid){
+    mquant_pwk[i] = bxid;
     rei = 1U; /* Changed something, so worth iterating */
    }
 
@@ -139,53 +249,48 @@ static void mquant_rearrange(iquant_pal_t* pal, auint pdep)
   ** zero). */
 
   for (i = 0U; i < mquant_bct; i++){ /* For every bucket */
+   mquant_bavg(i, pdep);
+  }
 
-   r = 0U;
-   g = 0U;
-   b = 0U;
-   c = 0U;
-
-   for (j = 0U; j < (pal->cct); j++){ /* For every color in the bucket 'i' */
-    if (pal->col[j].wrk == i){
-     r += ((pal->col[j].col >> 16) & 0xFFU) * pal->col[j].occ;
-     g += ((pal->col[j].col >>  8) & 0xFFU) * pal->col[j].occ;
-     b += ((pal->col[j].col      ) & 0xFFU) * pal->col[j].occ;
-     c += pal->col[j].occ;
-    }
-   }
+  /* If there is no need to iterate further, stop here */
 
-   if (c != 0U){ /* (The mask with 0xFF shouldn't be necessary) */
+  if (rei == 0U){
+   ISTAT_INC(ISTAT_MQ_RCONV);
+   break;
+  }
 
-    r = ((r + (c >> 1)) / c) & 0xFFU;
-    g = ((g + (c >> 1)) / c) & 0xFFU;
-    b = ((b + (c >> 1)) / c) & 0xFFU;
-    t = coldepth_d((r << 16) | (g << 8) | (b), pdep);
+ }
 
-    /* Only assign the new color if it is distinct and the bucket's occurrence
-    ** didn't decrease too much. */
+}
 
-    if (c >= ((mquant_boc[i] + 1U) / 2U)){
-     for (j = 0U; j < mquant_bct; j++){
-      if (i != j){
-       if (mquant_bcl[j] == t){ break; }
-      }
-     }
-     if (j == mquant_bct){
-      mquant_bcl[i] = t;
-      mquant_boc[i] = c;
-     }
-    }
 
-   }
 
-  }
+/* Limited color rearrangement after a split, used when the time budget is
+** exhausted. Only the colors of the two buckets produced by the split are
+** distributed between them, then these two buckets are re-averaged. */
+static void mquant_rsplit(auint b0, auint b1, auint pdep)
+{
+ auint i;
+ auint w;
 
-  /* If there is no need to iterate further, stop here */
+ ISTAT_INC(ISTAT_MQ_REARR);
 
-  if (rei == 0U){ break; }
+ mquant_cocc();
 
+ for (i = 0U; i < mquant_pct; i++){
+  w = mquant_pwk[i];
+  if ((w == b0) || (w == b1)){
+   if ( coldiff(mquant_pcl[i], mquant_bcl[b0]) <=
+        coldiff(mquant_pcl[i], mquant_bcl[b1]) ){
+    mquant_pwk[i] = b0;
+   }else{
+    mquant_pwk[i] = b1;
+   }
+  }
  }
 
+ mquant_bavg(b0, pdep);
+ mquant_bavg(b1, pdep);
 }
 
 
@@ -194,7 +299,7 @@ static void mquant_rearrange(iquant_pal_t* pal, auint pdep)
 ** difference (Median Cut), bucket's occurrence, and the expectable result
 ** after split (in terms of how large will be the resulting bucket halves).
 ** Bucket occurrences and the palette's difference matrix must be prepared */
-static void mquant_calcsplitw(iquant_pal_t* pal, auint bid)
+static void mquant_calcsplitw(auint bid)
 {
  auint bxc0 = 0U;
  auint bxc1 = 0U;
@@ -214,15 +319,15 @@ static void mquant_calcsplitw(iquant_pal_t* pal, auint bid)
 
  bxvl = 0.0;
 
- for (i = 0U; i < (pal->cct); i++){
+ for (i = 0U; i < mquant_pct; i++){
 
-  if (pal->col[i].wrk == bid){
+  if (mquant_pwk[i] == bid){
 
    b = i * MQUANT_COLS;
-   for (j = i + 1U; j < (pal->cct); j++){
+   for (j = i + 1U; j < mquant_pct; j++){
 
     f0 = (float)(mquant_dif[b + j]);
-    if ( (pal->col[j].wrk == bid) && /* Same bucket */
+    if ( (mquant_pwk[j] == bid) && /* Same bucket */
          (f0 > bxvl) ){              /* Larger difference */
      bxvl = f0;
      bxc0 = i;
@@ -242,13 +347,15 @@ static void mquant_calcsplitw(iquant_pal_t* pal, auint bid)
 
  crvl = 1.0; /* If there is only one bucket, prevent zero result */
 
- for (i = 0U; i < (pal->cct); i++){
-  if (pal->col[i].wrk == bid){
+ for (i = 0U; i < mquant_pct; i++){
+  if (mquant_lim){ break; } /* Skipped when out of time budget */
+  if (mquant_pwk[i] == bid){
 
    for (j = 0U; j < mquant_bct; j++){
     if (j != bid){
 
-     f0 = (float)(coldiff(pal->col[i].col, mquant_bcl[j]));
+     f0 = (float)(coldiff_hsl(mquant_pcl[i], mquant_phs[i], mquant_plm[i],
+                              mquant_bcl[j], mquant_bhs[j], mquant_blm[j]));
      if (f0 > crvl){
       crvl = f0;
      }
@@ -265,9 +372,9 @@ static void mquant_calcsplitw(iquant_pal_t* pal, auint bid)
  bxp0 = 0U;
  bxp1 = 0U;
 
- for (i = 0U; i < (pal->cct); i++){
+ for (i = 0U; i < mquant_pct; i++){
 
-  if (pal->col[i].wrk == bid){
+  if (mquant_pwk[i] == bid){
 
    if      (bxc0 < i){ f0 = mquant_dif[(bxc0 * MQUANT_COLS) + i]; }
    else if (bxc0 > i){ f0 = mquant_dif[(i * MQUANT_COLS) + bxc0]; }
@@ -276,8 +383,8 @@ static void mquant_calcsplitw(iquant_pal_t* pal, auint bid)
    else if (bxc1 > i){ f1 = mquant_dif[(i * MQUANT_COLS) + bxc1]; }
    else              { f1 = 0.0; }
 
-   if (f0 < f1){ bxp0 += pal->col[i].occ; }
-   else        { bxp1 += pal->col[i].occ; }
+   if (f0 < f1){ bxp0 += mquant_poc[i]; }
+   else        { bxp1 += mquant_poc[i]; }
 
   }
 
@@ -328,18 +435,201 @@ static void mquant_calcsplitw(iquant_pal_t* pal, auint bid)
 
 
 
-/* The main quantizer pass, reducing the occurrence weighted palette to the
-** given count of colors. The pdep parameter can be used to force a bit depth
-** on the palette it generates (1 - 8 bits). */
-void mquant(iquant_pal_t* pal, auint cols, auint pdep)
+/* Sets the count of rearrangement iterations performed after each split.
+** The four values apply for up to 16, 32, 64 and above buckets
+** respectively. More iterations improve quality at the expense of speed. */
+void mquant_setitr(auint const* itr)
+{
+ auint i;
+ for (i = 0U; i < 4U; i++){ mquant_itr[i] = itr[i]; }
+}
+
+
+
+/* Sets a time budget deadline, as a time stamp from itime_get(). When it is
+** exceeded, the quantizer refines less (cheaper split weights, rearranging
+** only the colors of split buckets), still producing the requested count of
+** colors. Zero removes the deadline. */
+void mquant_setbudget(double dln)
+{
+ mquant_dln = dln;
+}
+
+
+
+/* Sets a seed palette to start from instead of a single bucket, such as the
+** palette of a previous version of the image. Buckets are initialized from
+** its colors and converged by rearrangement, then split or merged as needed
+** to reach the requested color counts. NULL removes the seed. The palette
+** must remain valid while it is in use. */
+void mquant_setseed(iquant_pal_t const* spal)
+{
+ mquant_spal = spal;
+}
+
+
+
+/* Prepares the difference matrix of the occurrence weighted palette. This
+** only depends on the colors of the palette, so it may be reused for multiple
+** quantizer passes over the same palette. */
+void mquant_prep(iquant_pal_t const* pal)
+{
+ auint i;
+ auint j;
+ auint k;
+
+ if ((pal->cct) > MQUANT_COLS){ return; } /* mquant_multi will reject it */
+
+ for (i = 0U; i < (pal->cct); i++){
+  k = i * MQUANT_COLS;
+  for (j = i + 1U; j < (pal->cct); j++){
+   mquant_dif[k + j] = coldiff(pal->col[j].col, pal->col[i].col);
+  }
+ }
+}
+
+
+
+/* Produces a palette from the current bucket layout into opal: the final
+** bucket averaging. If rst is set, the bucket layout is restored afterwards,
+** so the quantizer may continue splitting as if this didn't happen. */
+static void mquant_snap(iquant_pal_t* pal, auint pdep, iquant_pal_t* opal, auint rst)
+{
+ auint i;
+
+ printf("MQuant: Assembling palette of %u colors\n", mquant_bct);
+
+ if (rst){
+  for (i = 0U; i < mquant_pct; i++){ mquant_swk[i] = mquant_pwk[i]; }
+  for (i = 0U; i < mquant_bct; i++){
+   mquant_sbc[i] = mquant_bcl[i];
+   mquant_sbo[i] = mquant_boc[i];
+  }
+ }
+
+ mquant_rearrange(pdep); /* Just the final bucket averaging: the palette. */
+
+ for (i = 0U; i < mquant_bct; i++){ /* Compact palette */
+  opal->col[i].col = mquant_bcl[i];
+  opal->col[i].occ = mquant_boc[i];
+  printf("Color %3u: 0x%06X (pixels: %u)\n", i, mquant_bcl[i], mquant_boc[i]);
+ }
+ opal->cct = mquant_bct; /* Update to true palette size */
+ opal->ocs = pal->ocs;
+
+ if (rst){
+  for (i = 0U; i < mquant_pct; i++){ mquant_pwk[i] = mquant_swk[i]; }
+  for (i = 0U; i < mquant_bct; i++){
+   mquant_bcl[i] = mquant_sbc[i];
+   mquant_boc[i] = mquant_sbo[i];
+  }
+ }
+}
+
+
+
+/* Initializes buckets from the seed palette, converging the colors into
+** them. Seed colors are reduced to the palette depth, duplicates dropped. */
+static void mquant_sinit(auint pdep)
+{
+ auint i;
+ auint j;
+ auint t;
+
+ mquant_bct = 0U;
+ for (i = 0U; i < (mquant_spal->cct); i++){
+  if (mquant_bct == MQUANT_COLS){ break; }
+  t = coldepth_d(mquant_spal->col[i].col, pdep);
+  for (j = 0U; j < mquant_bct; j++){
+   if (mquant_bcl[j] == t){ break; }
+  }
+  if (j == mquant_bct){
+   mquant_bcl[mquant_bct] = t;
+   mquant_bct ++;
+  }
+ }
+ if (mquant_bct == 0U){ /* Empty seed: fall back to a single bucket */
+  mquant_bcl[0] = 0U;
+  mquant_bct    = 1U;
+ }
+
+ printf("MQuant: Starting from %u seed colors\n", mquant_bct);
+
+ mquant_rearrange(pdep);
+}
+
+
+
+/* Merges the bucket costing the least (by occurrence and distance to its
+** nearest other bucket) into its nearest bucket, removing one bucket. Its
+** colors go to the nearest bucket, the last bucket moves into its place. */
+static void mquant_merge(auint pdep)
+{
+ auint i;
+ auint j;
+ auint t;
+ auint d;
+ auint bnr;
+ auint bxid = 0U;
+ auint bxnr = 0U;
+ float bxvl = FLT_LARGE;
+ float f0;
+
+ mquant_cocc();
+
+ for (i = 0U; i < mquant_bct; i++){
+  bnr = i;
+  t = 0xFFFFFFFFU;
+  for (j = 0U; j < mquant_bct; j++){
+   if (j != i){
+    d = coldiff(mquant_bcl[i], mquant_bcl[j]);
+    if (d < t){
+     t   = d;
+     bnr = j;
+    }
+   }
+  }
+  f0 = (float)(mquant_boc[i]) * (float)(t);
+  if (f0 < bxvl){
+   bxvl = f0;
+   bxid = i;
+   bxnr = bnr;
+  }
+ }
+
+ /* Remove bucket, moving the last one into its place */
+
+ t = bxnr;
+ if (t == (mquant_bct - 1U)){ t = bxid; }
+ for (i = 0U; i < mquant_pct; i++){
+  if (mquant_pwk[i] == bxid){ mquant_pwk[i] = t; }
+  if (mquant_pwk[i] == (mquant_bct - 1U)){ mquant_pwk[i] = bxid; }
+ }
+ mquant_bcl[bxid] = mquant_bcl[mquant_bct - 1U];
+ mquant_bct --;
+
+ mquant_rearrange(pdep);
+}
+
+
+
+/* The main quantizer pass producing palettes for multiple color counts in
+** one run. The cols array holds ccnt color counts in increasing order, for
+** each a palette is produced in the respective element of opal, identical to
+** what separate mquant() runs would give. The palette must be prepared with
+** mquant_prep() first. The pal parameter may be the same as the last element
+** of opal, then it is overwritten with the result like by mquant(). */
+void mquant_multi(iquant_pal_t* pal, auint const* cols, auint ccnt, auint pdep, iquant_pal_t* opal)
 {
  auint bxid;
  float bxvl;
  auint bxc0;
  auint bxc1;
+ auint lsp;
+ auint sid;
+ auint bsav;
  auint i;
  auint j;
- auint k;
 
  /* Check if palette can be used */
 
@@ -348,38 +638,87 @@ void mquant(iquant_pal_t* pal, auint cols, auint pdep)
   return;
  }
 
- /* Initialize work data: bucket assingments */
+ /* Initialize work data: the palette's colors and occurrences, and bucket
+ ** assingments */
 
- for (i = 0U; i < (pal->cct); i++){
-  pal->col[i].wrk = 0U; /* Every color initially goes into the same bucket */
+ mquant_pct = pal->cct;
+ for (i = 0U; i < mquant_pct; i++){
+  mquant_pcl[i] = pal->col[i].col;
+  mquant_poc[i] = pal->col[i].occ;
+  mquant_phs[i] = coldiff_hs(mquant_pcl[i]);
+  mquant_plm[i] = coldiff_getlum(mquant_pcl[i]);
+  mquant_pwk[i] = 0U; /* Every color initially goes into the same bucket */
  }
  mquant_bct = 1U; /* Start with one bucket */
  mquant_bcl[0] = 0U;
+ mquant_lim = 0U;
+ lsp = MQUANT_COLS; /* No last split: calculate all split weights */
+ sid = 0U;          /* Next palette to produce */
 
- /* Quantization pass: Median Cut with a twist: after every iteration, the
- ** colors are re-arranged to fit the new bucket layout better */
+ /* With a seed palette, start from its colors. Palettes of color counts
+ ** below the seed's are produced by merging buckets, then the seeded layout
+ ** is restored to split from it for the larger counts. */
 
- printf("MQuant: Reducing color count to %u colors\n", cols);
+ if (mquant_spal != NULL){
 
- /* Pre-calculate the color difference matrix */
+  mquant_sinit(pdep);
 
- for (i = 0U; i < (pal->cct); i++){
-  k = i * MQUANT_COLS;
-  for (j = i + 1U; j < (pal->cct); j++){
-   mquant_dif[k + j] = coldiff(pal->col[j].col, pal->col[i].col);
+  while ((sid < ccnt) && (cols[sid] < mquant_bct)){ sid ++; }
+
+  if (sid != 0U){
+   bsav = mquant_bct;
+   for (i = 0U; i < mquant_pct; i++){ mquant_swk[i] = mquant_pwk[i]; }
+   for (i = 0U; i < mquant_bct; i++){ mquant_sbc[i] = mquant_bcl[i]; }
+   for (j = sid; j > 0U; j--){
+    printf("MQuant: Merging down to %u colors\n", cols[j - 1U]);
+    while (mquant_bct > cols[j - 1U]){ mquant_merge(pdep); }
+    mquant_snap(pal, pdep, &(opal[j - 1U]), 0U);
+   }
+   mquant_bct = bsav;
+   for (i = 0U; i < mquant_pct; i++){ mquant_pwk[i] = mquant_swk[i]; }
+   for (i = 0U; i < mquant_bct; i++){ mquant_bcl[i] = mquant_sbc[i]; }
+   mquant_cocc();
   }
+
+  if (sid == ccnt){ return; } /* All produced by merging */
+
  }
 
+ /* Quantization pass: Median Cut with a twist: after every iteration, the
+ ** colors are re-arranged to fit the new bucket layout better */
+
+ printf("MQuant: Reducing color count to %u colors\n", cols[ccnt - 1U]);
+
  /* Quantization loop: Ideally produce the requested number of colors, however
  ** it is possible that the image just doesn't contain enough distinct colors
  ** to do it, then it will bail out sooner. */
 
- while (mquant_bct < cols){
+ while (mquant_bct < cols[ccnt - 1U]){
+
+  /* Snapshot palettes of intermediate color counts on the way */
+
+  if (mquant_bct == cols[sid]){
+   printf("\n");
+   mquant_snap(pal, pdep, &(opal[sid]), 1U);
+   sid ++;
+  }
+  if ( (mquant_dln != 0.0) &&
+       (mquant_lim == 0U) &&
+       (itime_get() > mquant_dln) ){
+   mquant_lim = 1U;
+   printf("\nMQuant: Time budget exhausted at %u colors, refining less\n", mquant_bct);
+  }
 
-  mquant_cocc(pal); /* Calculate occurrences */
+  mquant_cocc(); /* Calculate occurrences */
+  mquant_bfeat();
 
-  for (i = 0U; i < mquant_bct; i++){ /* Calculate split weights */
-   mquant_calcsplitw(pal, i);
+  if ((mquant_lim) && (lsp != MQUANT_COLS)){ /* Only the buckets changed by the last split */
+   mquant_calcsplitw(lsp);
+   mquant_calcsplitw(mquant_bct - 1U);
+  }else{
+   for (i = 0U; i < mquant_bct; i++){ /* Calculate split weights */
+    mquant_calcsplitw(i);
+   }
   }
 
   /* Try splitting until finding a split which produces new colors */
@@ -413,10 +752,12 @@ void mquant(iquant_pal_t* pal, auint cols, auint pdep)
 
    if (bxid == MQUANT_COLS){ break; } /* Can not split any more */
 
+   ISTAT_INC(ISTAT_MQ_SPLIT);
+
    bxc0 = mquant_bxc0[bxid];
    bxc1 = mquant_bxc1[bxid];
-   bxc0 = coldepth_d(pal->col[bxc0].col, pdep);
-   bxc1 = coldepth_d(pal->col[bxc1].col, pdep);
+   bxc0 = coldepth_d(mquant_pcl[bxc0], pdep);
+   bxc1 = coldepth_d(mquant_pcl[bxc1], pdep);
 
    /* Check if both of the colors are new. If so, the split is OK, otherwise
    ** something else has to be tried. */
@@ -439,6 +780,7 @@ void mquant(iquant_pal_t* pal, auint cols, auint pdep)
    }else{          /* Need to try again */
 
     mquant_dis[bxid] = 1U; /* Disable, so something else will be split */
+    ISTAT_INC(ISTAT_MQ_REJECT);
 
    }
 
@@ -452,7 +794,12 @@ void mquant(iquant_pal_t* pal, auint cols, auint pdep)
   ** beneficial to fit with the new set of colors. Note that in this process
   ** no color equivalence may occur. */
 
-  mquant_rearrange(pal, pdep);
+  if (mquant_lim){
+   mquant_rsplit(bxid, mquant_bct - 1U, pdep);
+   lsp = bxid;
+  }else{
+   mquant_rearrange(pdep);
+  }
 
   printf("."); /* Just an indicator of progress... */
   fflush(stdout);
@@ -461,18 +808,26 @@ void mquant(iquant_pal_t* pal, auint cols, auint pdep)
 
  printf("\n");
 
- /* Now the bucket count is reduced to the desired color count. Create a
- ** proper palette from it. */
+ /* Now the bucket count is reduced to the desired color count (or the
+ ** quantizer could not proceed any further). Create the remaining palettes
+ ** from it. */
 
- printf("MQuant: Assembling palette of %u colors\n", mquant_bct);
+ mquant_snap(pal, pdep, &(opal[sid]), 0U);
+ for (i = sid + 1U; i < ccnt; i++){
+  opal[i].cct = opal[sid].cct;
+  opal[i].ocs = opal[sid].ocs;
+  memcpy(opal[i].col, opal[sid].col, sizeof(iquant_col_t) * opal[sid].cct);
+ }
+
+}
 
- mquant_rearrange(pal, pdep); /* Just the final bucket averaging: the palette. */
 
- for (i = 0U; i < mquant_bct; i++){ /* Compact palette */
-  pal->col[i].col = mquant_bcl[i];
-  pal->col[i].occ = mquant_boc[i];
-  printf("Color %3u: 0x%06X (pixels: %u)\n", i, mquant_bcl[i], mquant_boc[i]);
- }
- pal->cct = mquant_bct; /* Update to true palette size */
 
+/* The main quantizer pass, reducing the occurrence weighted palette to the
+** given count of colors. The pdep parameter can be used to force a bit depth
+** on the palette it generates (1 - 8 bits). */
+void mquant(iquant_pal_t* pal, auint cols, auint pdep)
+{
+ mquant_prep(pal);
+ mquant_multi(pal, &cols, 1U, pdep, pal);
 }
@@ -38,6 +38,42 @@
 #define MQUANT_COLS 2048U
 
 
+/* Sets the count of rearrangement iterations performed after each split.
+** The four values apply for up to 16, 32, 64 and above buckets
+** respectively. More iterations improve quality at the expense of speed. */
+void mquant_setitr(auint const* itr);
+
+
+/* Sets a time budget deadline, as a time stamp from itime_get(). When it is
+** exceeded, the quantizer refines less (cheaper split weights, rearranging
+** only the colors of split buckets), still producing the requested count of
+** colors. Zero removes the deadline. */
+void mquant_setbudget(double dln);
+
+
+/* Sets a seed palette to start from instead of a single bucket, such as the
+** palette of a previous version of the image. Buckets are initialized from
+** its colors and converged by rearrangement, then split or merged as needed
+** to reach the requested color counts. NULL removes the seed. The palette
+** must remain valid while it is in use. */
+void mquant_setseed(iquant_pal_t const* spal);
+
+
+/* Prepares the difference matrix of the occurrence weighted palette. This
+** only depends on the colors of the palette, so it may be reused for multiple
+** quantizer passes over the same palette. */
+void mquant_prep(iquant_pal_t const* pal);
+
+
+/* The main quantizer pass producing palettes for multiple color counts in
+** one run. The cols array holds ccnt color counts in increasing order, for
+** each a palette is produced in the respective element of opal, identical to
+** what separate mquant() runs would give. The palette must be prepared with
+** mquant_prep() first. The pal parameter may be the same as the last element
+** of opal, then it is overwritten with the result like by mquant(). */
+void mquant_multi(iquant_pal_t* pal, auint const* cols, auint ccnt, auint pdep, iquant_pal_t* opal);
+
+
 /* The main quantizer pass, reducing the occurrence weighted palette to the
 ** given count of colors. The pdep parameter can be used to force a bit depth
 ** on the palette it generates (1 - 8 bits). */
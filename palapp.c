@@ -24,14 +24,198 @@
 
 #include "palapp.h"
 #include "coldiff.h"
+#include "istat.h"
+#include "palut.h"
 #include "idata.h"
 
 
 
+/* Dithering strengths by palette size (up to 8, 16, 32, 64, and above
+** colors). Larger values give stronger dithering. */
+static auint palapp_dst[5] = {6U, 5U, 4U, 3U, 2U};
+
+/* Maximal image width for the ditherer's row buffers */
+#define PALAPP_MAXW 16384U
+
+/* Ditherer rolling source difference rows: horizontal differences (between
+** each pixel and its left neighbor) of the previous and the current row */
+static auint palapp_d_hr[2][PALAPP_MAXW];
+
+/* Palette being applied (up to 256 colors) in separate arrays: the colors,
+** and their features for coldiff_hsl() and coldiff_lb() */
+static auint palapp_p_col[256];
+static auint palapp_p_hs[256];
+static auint palapp_p_lm[256];
+
+/* Maximal count of candidates in approximate mode */
+#define PALAPP_KMAX 64U
+
+/* Count of candidates in approximate mode (nearest color and its nearest
+** neighbors), zero for exact results */
+static auint palapp_kcn = 0U;
+
+/* Approximate mode: nearest neighbors of each palette color */
+static uint8 palapp_k_nbr[256U * PALAPP_KMAX];
+
+/* Approximate mode: nearest color cache size (power of 2) */
+#define PALAPP_KCSIZ 4096U
+
+/* Nearest color cache by target color: the color (empty slot if over 24
+** bits) and the nearest palette index (approximate and hybrid modes) */
+static auint palapp_k_cc[PALAPP_KCSIZ];
+static uint8 palapp_k_ci[PALAPP_KCSIZ];
+
+/* Hybrid dithering: flatness sum (see palapp_d_flv()) from which pixels are
+** not dithered, zero to dither all */
+static auint palapp_hyb = 0U;
+
+/* Hybrid dithering: count of pixels dithered and not dithered */
+static auint palapp_h_dn;
+static auint palapp_h_fn;
+
+/* Dither decision memo maximal size (power of 2) */
+#define PALAPP_MMAX 65536U
+
+/* Dither decision memo: the target color (empty slot if over 24 bits), the
+** three neighbor colors, the strength and the resulting palette index. Its
+** used size (mask) is selected by the image size. */
+static auint palapp_m_tg[PALAPP_MMAX];
+static auint palapp_m_c0[PALAPP_MMAX];
+static auint palapp_m_c1[PALAPP_MMAX];
+static auint palapp_m_c2[PALAPP_MMAX];
+static uint8 palapp_m_ds[PALAPP_MMAX];
+static uint8 palapp_m_id[PALAPP_MMAX];
+static auint palapp_m_msk;
+
+/* Ordered dithering: 4x4 Bayer threshold matrix (0 - 15) */
+static const uint8 palapp_o_thr[16] = {
+  0U,  8U,  2U, 10U,
+ 12U,  4U, 14U,  6U,
+  3U, 11U,  1U,  9U,
+ 15U,  7U, 13U,  5U};
+
+/* Ordered dithering: count of mixing candidates (neighbors) per color */
+#define PALAPP_ONBR 8U
+
+/* Ordered dithering: mixing candidates of each palette color */
+static uint8 palapp_o_nbr[256U * PALAPP_ONBR];
+
+/* Ordered dithering: decision cache size (power of 2) */
+#define PALAPP_OCSIZ 4096U
+
+/* Ordered dithering: decision cache by source color: the color (empty slot
+** if over 24 bits), the two palette indices and the mixing ratio (0 - 16) */
+static auint palapp_o_cc[PALAPP_OCSIZ];
+static uint8 palapp_o_ca[PALAPP_OCSIZ];
+static uint8 palapp_o_cb[PALAPP_OCSIZ];
+static uint8 palapp_o_ct[PALAPP_OCSIZ];
+
+
+
+/* Calculates the cost of a palette color as the fourth color of a set, to
+** average towards a target color: the difference of the resulting average
+** (r, g, b: the other three colors' contribution) and of the color itself
+** (t: its difference to the target) weighted by the dithering strength. */
+static auint palapp_d_cst(auint tg, auint r, auint g, auint b, auint col, auint t, auint dst)
+{
+ auint c;
+
+ c = (((r + ((col >> 16) & 0xFFU)) / 3U) << 16) |
+     (((g + ((col >>  8) & 0xFFU)) / 3U) <<  8) |
+     (((b + ((col      ) & 0xFFU)) / 3U)      );
+ return coldiff(tg, c) + (t >> dst) + ((t * t) >> (dst + 6U));
+}
+
+
+
+/* Prepares the palette being applied in the separate arrays (palettes of up
+** to 256 colors). */
+static void palapp_p_prep(iquant_pal_t const* pal)
+{
+ auint i;
+
+ if ((pal->cct) <= 256U){
+  for (i = 0U; i < (pal->cct); i++){
+   palapp_p_col[i] = pal->col[i].col;
+   palapp_p_hs[i]  = coldiff_hs(pal->col[i].col);
+   palapp_p_lm[i]  = coldiff_getlum(pal->col[i].col);
+  }
+ }
+}
+
+
+
+/* Returns the palette index of the color nearest to the target color, its
+** difference in dif (lowest index on ties). Palettes of up to 256 colors
+** are searched in the prepared arrays, skipping colors whose difference
+** lower bound is not below the nearest so far. */
+static auint palapp_p_near(auint tg, iquant_pal_t const* pal, auint* dif)
+{
+ auint i;
+ auint t;
+ auint c = 0xFFFFFFFFU;
+ auint ni = 0U;
+ auint ths;
+ auint tlm;
+
+ if ((pal->cct) > 256U){
+  for (i = 0U; i < (pal->cct); i++){
+   t = coldiff(tg, pal->col[i].col);
+   if (t < c){
+    c  = t;
+    ni = i;
+   }
+  }
+ }else{
+  ths = coldiff_hs(tg);
+  tlm = coldiff_getlum(tg);
+  for (i = 0U; i < (pal->cct); i++){
+   if (coldiff_lb(ths, tlm, palapp_p_hs[i], palapp_p_lm[i]) < c){
+    t = coldiff_hsl(tg, ths, tlm, palapp_p_col[i], palapp_p_hs[i], palapp_p_lm[i]);
+    if (t < c){
+     c  = t;
+     ni = i;
+    }
+   }
+  }
+ }
+
+ *dif = c;
+ return ni;
+}
+
+
+
+/* Returns the palette index of the color nearest to the target color,
+** cached by the target color (palettes of up to 256 colors). */
+static auint palapp_d_near(auint tg, iquant_pal_t const* pal)
+{
+ auint h;
+ auint t;
+
+ h = ((tg * 2654435761U) >> 20) & (PALAPP_KCSIZ - 1U);
+ if (palapp_k_cc[h] != tg){
+  palapp_k_cc[h] = tg;
+  palapp_k_ci[h] = palapp_p_near(tg, pal, &t);
+ }
+
+ return palapp_k_ci[h];
+}
+
+
+
 /* Calculates fourth color to complete a set, to average towards a target
 ** color. The fourth color is obtained from the passed palette, by index.
 ** 'c0' takes less weight than 'c1' or 'c2': it should be the corner
-** neighbor color. */
+** neighbor color.
+** Normally the result is exact, however the search is shortened: the cost
+** of a color is at least its weighted difference to the target, so colors
+** where this alone exceeds the best cost so far (starting from the target's
+** nearest color) can not win. The difference is bounded from below by the
+** saturation and luminosity alone, so most of these colors are skipped
+** without calculating it. With approximate candidate lists
+** (palapp_setcand()) only the nearest color and its nearest neighbors are
+** considered. */
 static auint palapp_d_avg(auint tg, auint c0, auint c1, auint c2, iquant_pal_t const* pal, auint dst)
 {
  auint r;
@@ -40,8 +224,12 @@ static auint palapp_d_avg(auint tg, auint c0, auint c1, auint c2, iquant_pal_t c
  auint c;
  auint i;
  auint t;
+ auint h;
  auint md;
  auint mi;
+ auint ni;
+ auint ths;
+ auint tlm;
 
  r = (( ((c0 >> 16) & 0xFFU) +
         ((c1 >> 16) & 0xFFU) +
@@ -55,16 +243,60 @@ static auint palapp_d_avg(auint tg, auint c0, auint c1, auint c2, iquant_pal_t c
 
  md = 0xFFFFFFFFU;
  mi = 0U;
- for (i = 0U; i < (pal->cct); i++){
-  c = (((r + ((pal->col[i].col >> 16) & 0xFFU)) / 3U) << 16) |
-      (((g + ((pal->col[i].col >>  8) & 0xFFU)) / 3U) <<  8) |
-      (((b + ((pal->col[i].col      ) & 0xFFU)) / 3U)      );
-  t = coldiff(tg, pal->col[i].col);
-  c = coldiff(tg, c) + (t >> dst) + ((t * t) >> (dst + 6U));
-  if (c < md){
-   md = c;
-   mi = i;
+
+ if ((pal->cct) > 256U){ /* Too large palette for the shortlists */
+
+  for (i = 0U; i < (pal->cct); i++){
+   t = coldiff(tg, pal->col[i].col);
+   c = palapp_d_cst(tg, r, g, b, pal->col[i].col, t, dst);
+   if (c < md){
+    md = c;
+    mi = i;
+   }
+  }
+
+ }else if (palapp_kcn != 0U){ /* Approximate: nearest color's neighbors */
+
+  ni  = palapp_d_near(tg, pal);
+  ths = coldiff_hs(tg);
+  tlm = coldiff_getlum(tg);
+
+  for (i = 0U; i < palapp_kcn; i++){
+   if (i == 0U){ h = ni; }
+   else        { h = palapp_k_nbr[(ni * (palapp_kcn - 1U)) + i - 1U]; }
+   t = coldiff_hsl(tg, ths, tlm, palapp_p_col[h], palapp_p_hs[h], palapp_p_lm[h]);
+   c = palapp_d_cst(tg, r, g, b, palapp_p_col[h], t, dst);
+   if ((c < md) || ((c == md) && (h < mi))){
+    md = c;
+    mi = h;
+   }
   }
+
+ }else{ /* Exact: skip colors which can not win */
+
+  ni  = palapp_d_near(tg, pal);
+  ths = coldiff_hs(tg);
+  tlm = coldiff_getlum(tg);
+  t   = coldiff_hsl(tg, ths, tlm, palapp_p_col[ni], palapp_p_hs[ni], palapp_p_lm[ni]);
+  md  = palapp_d_cst(tg, r, g, b, palapp_p_col[ni], t, dst);
+  mi  = ni;
+
+  for (i = 0U; i < (pal->cct); i++){
+   if (i != ni){
+    t = coldiff_lb(ths, tlm, palapp_p_hs[i], palapp_p_lm[i]);
+    if (((t >> dst) + ((t * t) >> (dst + 6U))) <= md){
+     t = coldiff_hsl(tg, ths, tlm, palapp_p_col[i], palapp_p_hs[i], palapp_p_lm[i]);
+     if (((t >> dst) + ((t * t) >> (dst + 6U))) <= md){
+      c = palapp_d_cst(tg, r, g, b, palapp_p_col[i], t, dst);
+      if ((c < md) || ((c == md) && (i < mi))){ /* Ties: lowest index as in a full scan */
+       md = c;
+       mi = i;
+      }
+     }
+    }
+   }
+  }
+
  }
 
  return mi;
@@ -72,9 +304,69 @@ static auint palapp_d_avg(auint tg, auint c0, auint c1, auint c2, iquant_pal_t c
 
 
 
+/* Prepares the dither decision memo for an image of the given pixel count:
+** about one slot for every eight pixels, emptied. */
+static void palapp_m_prep(auint px)
+{
+ auint i;
+
+ palapp_m_msk = 1024U;
+ while ((palapp_m_msk < PALAPP_MMAX) && ((palapp_m_msk * 8U) < px)){
+  palapp_m_msk <<= 1;
+ }
+ palapp_m_msk --;
+ for (i = 0U; i <= palapp_m_msk; i++){
+  palapp_m_tg[i] = 0xFFFFFFFFU;
+ }
+}
+
+
+
+/* Memoized palapp_d_avg(): flat shaded images repeat the same target and
+** neighbor colors a lot, so decisions are kept by these. */
+static auint palapp_d_mem(auint tg, auint c0, auint c1, auint c2, iquant_pal_t const* pal, auint dst)
+{
+ auint h;
+
+ if ((pal->cct) > 256U){ return palapp_d_avg(tg, c0, c1, c2, pal, dst); }
+
+ h = (((tg ^ (c0 * 3U) ^ (c1 * 5U) ^ (c2 * 7U) ^ (dst << 24)) * 2654435761U) >> 12) & palapp_m_msk;
+
+ if ( (palapp_m_tg[h] == tg) &&
+      (palapp_m_c0[h] == c0) &&
+      (palapp_m_c1[h] == c1) &&
+      (palapp_m_c2[h] == c2) &&
+      (palapp_m_ds[h] == dst) ){
+  ISTAT_INC(ISTAT_DMEMO_HIT);
+ }else{
+  ISTAT_INC(ISTAT_DMEMO_MISS);
+  palapp_m_tg[h] = tg;
+  palapp_m_c0[h] = c0;
+  palapp_m_c1[h] = c1;
+  palapp_m_c2[h] = c2;
+  palapp_m_ds[h] = dst;
+  palapp_m_id[h] = palapp_d_avg(tg, c0, c1, c2, pal, dst);
+ }
+
+ return palapp_m_id[h];
+}
+
+
+
+/* Converts the sum of the six pairwise differences between 4 colors into a
+** flatness level (0: flat, 2: not flat), used to reduce dithering. */
+static auint palapp_d_flv(auint sum)
+{
+ if (sum < 1024U){ return 0U; }
+ if (sum < 4096U){ return 1U; }
+ return 2U;
+}
+
+
+
 /* Calculates overall difference between 4 colors, used to detect how "flat"
-** is the region which is dithered. If the region is not flat, then dithering
-** is reduced. */
+** is the region which is dithered (see palapp_d_flv()). If the region is not
+** flat, then dithering is reduced. */
 static auint palapp_d_flr(auint c0, auint c1, auint c2, auint c3)
 {
  auint ret;
@@ -86,63 +378,445 @@ static auint palapp_d_flr(auint c0, auint c1, auint c2, auint c3)
        coldiff(c1, c3) +
        coldiff(c2, c3);
 
- if (ret < 1024U){ return 0U; }
- if (ret < 4096U){ return 1U; }
- return 2U;
+ return ret;
 }
 
 
 
-/* Ditherizes the image in buf, into wrk. */
-void palapp_dither(uint8 const* buf, uint8* wrk, auint wd, auint hg, iquant_pal_t const* pal)
+/* Selects palette dithering strength by palette size */
+static auint palapp_d_str(iquant_pal_t const* pal)
 {
- auint i;
- auint j;
- auint c0;
- auint dst;
- auint ddf;
-
- /* Set dithering strength by palette size */
-
  if       (pal->cct <=  8U){
-  dst = 6U;
+  return palapp_dst[0];
  }else if (pal->cct <= 16U){
-  dst = 5U;
+  return palapp_dst[1];
  }else if (pal->cct <= 32U){
-  dst = 4U;
+  return palapp_dst[2];
  }else if (pal->cct <= 64U){
-  dst = 3U;
+  return palapp_dst[3];
  }else{
-  dst = 2U;
+  return palapp_dst[4];
  }
+}
 
- /* Quantize the image with dithering applied */
 
- printf("Dither: Quantizing the image (%u colors)\n", pal->cct);
 
- c0 = idata_get(buf, 0U);
- c0 = pal->col[palapp_d_avg(c0, c0, c0, c0, pal, dst)].col;
- idata_set(wrk, 0U, c0);
+/* Builds lists of the cnt (up to PALAPP_KMAX) nearest other colors of each
+** palette color into nbr, nearest first, from the prepared palette. In
+** small palettes the lists are padded with the color itself. */
+static void palapp_nbr(iquant_pal_t const* pal, uint8* nbr, auint cnt)
+{
+ auint i;
+ auint j;
+ auint k;
+ auint n;
+ auint t;
+ auint dif[PALAPP_KMAX];
+
+ for (i = 0U; i < (pal->cct); i++){
+  n = 0U;
+  for (j = 0U; j < (pal->cct); j++){
+   if (j != i){
+    t = coldiff_hsl(palapp_p_col[i], palapp_p_hs[i], palapp_p_lm[i],
+                    palapp_p_col[j], palapp_p_hs[j], palapp_p_lm[j]);
+    k = n;                              /* Insert sorted by difference */
+    while ((k > 0U) && (dif[k - 1U] > t)){
+     if (k < cnt){
+      dif[k] = dif[k - 1U];
+      nbr[(i * cnt) + k] = nbr[(i * cnt) + k - 1U];
+     }
+     k --;
+    }
+    if (k < cnt){
+     dif[k] = t;
+     nbr[(i * cnt) + k] = j;
+     if (n < cnt){ n ++; }
+    }
+   }
+  }
+  for (; n < cnt; n++){
+   nbr[(i * cnt) + n] = i;
+  }
+ }
+}
+
+
+
+/* Ordered dithering: prepares the palette, the mixing candidates of each
+** palette color (the nearest other colors), and empties the decision
+** cache. */
+static void palapp_o_prep(iquant_pal_t const* pal)
+{
+ auint i;
+
+ palapp_p_prep(pal);
+ palapp_nbr(pal, &(palapp_o_nbr[0]), PALAPP_ONBR);
+
+ for (i = 0U; i < PALAPP_OCSIZ; i++){
+  palapp_o_cc[i] = 0xFFFFFFFFU;
+ }
+}
+
+
+
+/* Ordered dithering: decides the two palette colors and their mixing ratio
+** for a source color into the given decision cache slot. */
+static void palapp_o_dec(auint col, iquant_pal_t const* pal, auint dst, auint h)
+{
+ auint i;
+ auint a;
+ auint b;
+ auint t;
+ auint mv;
+ auint mi;
+ auint mt;
+ auint ca;
+ auint cb;
+ asint dr;
+ asint dg;
+ asint db;
+ asint num;
+ asint den;
+
+ /* Nearest palette color */
+
+ a  = palapp_p_near(col, pal, &mv);
+ ca = palapp_p_col[a];
+
+ /* Best mixing partner: project the color onto the line towards each
+ ** candidate, weighing the result by how far the partner is (mixing far
+ ** colors is noisy). */
+
+ mi = a;
+ mt = 0U;
+ for (i = 0U; i < PALAPP_ONBR; i++){
+  b  = palapp_o_nbr[(a * PALAPP_ONBR) + i];
+  if (b == a){ break; }
+  cb = palapp_p_col[b];
+  dr = (asint)((cb >> 16) & 0xFFU) - (asint)((ca >> 16) & 0xFFU);
+  dg = (asint)((cb >>  8) & 0xFFU) - (asint)((ca >>  8) & 0xFFU);
+  db = (asint)((cb      ) & 0xFFU) - (asint)((ca      ) & 0xFFU);
+  den = (dr * dr) + (dg * dg) + (db * db);
+  num = (dr * ((asint)((col >> 16) & 0xFFU) - (asint)((ca >> 16) & 0xFFU))) +
+        (dg * ((asint)((col >>  8) & 0xFFU) - (asint)((ca >>  8) & 0xFFU))) +
+        (db * ((asint)((col      ) & 0xFFU) - (asint)((ca      ) & 0xFFU)));
+  if ((den != 0) && (num > 0)){
+   num = ((num * 16) + (den >> 1)) / den;
+   if (num > 16){ num = 16; }
+   t = ((auint)(((asint)((ca >> 16) & 0xFFU)) + ((dr * num) / 16)) << 16) |
+       ((auint)(((asint)((ca >>  8) & 0xFFU)) + ((dg * num) / 16)) <<  8) |
+       ((auint)(((asint)((ca      ) & 0xFFU)) + ((db * num) / 16))      );
+   t = coldiff(col, t) + (coldiff_hsl(ca, palapp_p_hs[a], palapp_p_lm[a],
+                                      cb, palapp_p_hs[b], palapp_p_lm[b]) >> dst);
+   if (t < mv){
+    mv = t;
+    mi = b;
+    mt = (auint)(num);
+   }
+  }
+ }
+
+ palapp_o_cc[h] = col;
+ palapp_o_ca[h] = a;
+ palapp_o_cb[h] = mi;
+ palapp_o_ct[h] = mt;
+}
+
+
+
+/* Sets the dithering strengths. The five values apply for palettes of up to
+** 8, 16, 32, 64 and above colors respectively, larger values give stronger
+** dithering (2 - 16). */
+void palapp_setdst(auint const* dst)
+{
+ auint i;
+ for (i = 0U; i < 5U; i++){ palapp_dst[i] = dst[i]; }
+}
+
+
+
+/* Sets the count of candidate colors the ditherer considers for a pixel:
+** the nearest palette color and its nearest neighbors. Zero (default) gives
+** exact results, otherwise it is limited to 1 - 64, smaller counts are
+** faster, but less accurate. */
+void palapp_setcand(auint cnt)
+{
+ if (cnt > PALAPP_KMAX){ cnt = PALAPP_KMAX; }
+ palapp_kcn = cnt;
+}
+
+
+
+/* Sets the hybrid dithering threshold: pixels in busy regions, where the
+** sum of the six pairwise differences in their 2x2 neighborhood is at
+** least this, are not dithered, but get their nearest palette color, which
+** is much faster. Zero (default) dithers all pixels. */
+void palapp_sethybrid(auint thr)
+{
+ palapp_hyb = thr;
+}
+
+
+
+/* Ditherizes a pixel: returns the palette color for the target color (tg)
+** with the three already dithered neighbors (c0 - c2, c0 being the corner)
+** and the flatness sum of its neighborhood. Transparent pixels are left
+** alone, transparent neighbors are taken as if they matched the target. */
+static auint palapp_d_pix(auint tg, auint c0, auint c1, auint c2, iquant_pal_t const* pal,
+                          auint dst, auint fls)
+{
+ if (tg == IDATA_TRANSP){ return IDATA_TRANSP; }
+ if (((c0 | c1 | c2) & IDATA_TRANSP) != 0U){
+  if (c0 == IDATA_TRANSP){ c0 = tg; }
+  if (c1 == IDATA_TRANSP){ c1 = tg; }
+  if (c2 == IDATA_TRANSP){ c2 = tg; }
+ }
+ if ((palapp_hyb != 0U) && (fls >= palapp_hyb) && ((pal->cct) <= 256U)){
+  ISTAT_INC(ISTAT_HYB_FLAT);
+  palapp_h_fn ++;
+  return pal->col[palapp_d_near(tg, pal)].col;
+ }
+ ISTAT_INC(ISTAT_HYB_DITH);
+ palapp_h_dn ++;
+ return pal->col[palapp_d_mem(tg, c0, c1, c2, pal, dst - palapp_d_flv(fls))].col;
+}
+
+
+
+/* Checks whether a dithered pixel would come out the same as in the
+** previous frame: its source, and the sources and results of the neighbors
+** it depends on (q0 - q2, already processed) are unchanged. */
+static auint palapp_d_keep(auint const* buf, auint const* wrk, auint const* pbuf, auint const* pwrk,
+                           auint p, auint q0, auint q1, auint q2)
+{
+ if (pbuf == NULL){ return 0U; }
+ return ( (buf[p ] == pbuf[p ]) &&
+          (buf[q0] == pbuf[q0]) &&
+          (wrk[q0] == pwrk[q0]) &&
+          (buf[q1] == pbuf[q1]) &&
+          (wrk[q1] == pwrk[q1]) &&
+          (buf[q2] == pbuf[q2]) &&
+          (wrk[q2] == pwrk[q2]) );
+}
+
+
+
+/* Prepares dithering by the palette for an image (or images) of px pixels
+** in total: the palette, the candidate lists if approximate, and the
+** caches. Returns the dithering strength set by the palette size. */
+static auint palapp_d_prep(iquant_pal_t const* pal, auint px)
+{
+ auint i;
+
+ /* Prepare the palette, and the candidate lists if approximate */
+
+ palapp_p_prep(pal);
+ if ((palapp_kcn > 1U) && ((pal->cct) <= 256U)){
+  palapp_nbr(pal, &(palapp_k_nbr[0]), palapp_kcn - 1U);
+ }
+ for (i = 0U; i < PALAPP_KCSIZ; i++){
+  palapp_k_cc[i] = 0xFFFFFFFFU;
+ }
+ palapp_m_prep(px);
+ palapp_h_dn = 0U;
+ palapp_h_fn = 0U;
+
+ return palapp_d_str(pal);
+}
+
+
+
+/* Quantizes the image in buf into wrk with dithering of strength dst. In a
+** sequence (pbuf and pwrk not NULL), pixels which would come out the same
+** as in the previous frame are copied. Without a sequence, the flatness of
+** the source is calculated from rolling difference rows: of the six pairs
+** in a 2x2 neighborhood, the horizontal and vertical pairs are shared with
+** the neighboring pixels, so only four differences are new for each pixel.
+** On the image edges the neighborhood degenerates to four times a single
+** difference. */
+static void palapp_d_img(auint const* buf, auint* wrk, auint wd, auint hg, iquant_pal_t const* pal,
+                         auint dst, auint const* pbuf, auint const* pwrk)
+{
+ auint i;
+ auint j;
+ auint p;
+ auint c0;
+ auint c1;
+ auint c2;
+ auint fls;
+ auint dvl = 0U;
+ auint dvc;
+ auint* hrp;
+ auint* hrc;
+ auint* t;
+
+ hrp = &(palapp_d_hr[0][0]);
+ hrc = &(palapp_d_hr[1][0]);
+
+ if ((pbuf != NULL) && (buf[0U] == pbuf[0U])){
+  ISTAT_INC(ISTAT_SEQ_KEEP);
+  c0 = pwrk[0U];
+ }else{
+  c0 = buf[0U];
+  c0 = palapp_d_pix(c0, c0, c0, c0, pal, dst, 0U);
+ }
+ wrk[0U] = c0;
  for (i = 1U; i < wd; i++){
-  c0  = idata_get(buf, i);
-  ddf = dst - palapp_d_flr(c0, c0, idata_get(buf, i - 1U), idata_get(buf, i - 1U));
-  c0  = pal->col[palapp_d_avg(c0, c0, idata_get(wrk, i - 1U), c0, pal, ddf)].col;
-  idata_set(wrk, i, c0);
+  if (palapp_d_keep(buf, wrk, pbuf, pwrk, i, i - 1U, i - 1U, i - 1U)){
+   ISTAT_INC(ISTAT_SEQ_KEEP);
+   c0  = pwrk[i];
+  }else{
+   c0  = buf[i];
+   if (pbuf == NULL){
+    hrp[i] = coldiff(c0, buf[i - 1U]);
+    fls = hrp[i] * 4U;
+   }else{
+    fls = palapp_d_flr(c0, c0, buf[i - 1U], buf[i - 1U]);
+   }
+   c0  = palapp_d_pix(c0, c0, wrk[i - 1U], c0, pal, dst, fls);
+  }
+  wrk[i] = c0;
  }
  for (j = 1U; j < hg; j++){
-  c0  = idata_get(buf, j * wd);
-  ddf = dst - palapp_d_flr(c0, c0, idata_get(buf, (j - 1U) * wd), idata_get(buf, (j - 1U) * wd));
-  c0  = pal->col[palapp_d_avg(c0, c0, idata_get(wrk, (j - 1U) * wd), c0, pal, ddf)].col;
-  idata_set(wrk, j * wd, c0);
+  p = j * wd;
+  if (palapp_d_keep(buf, wrk, pbuf, pwrk, p, p - wd, p - wd, p - wd)){
+   ISTAT_INC(ISTAT_SEQ_KEEP);
+   c0  = pwrk[p];
+  }else{
+   c0  = buf[j * wd];
+   if (pbuf == NULL){
+    dvl = coldiff(c0, buf[(j - 1U) * wd]);
+    fls = dvl * 4U;
+   }else{
+    fls = palapp_d_flr(c0, c0, buf[(j - 1U) * wd], buf[(j - 1U) * wd]);
+   }
+   c0  = palapp_d_pix(c0, c0, wrk[(j - 1U) * wd], c0, pal, dst, fls);
+  }
+  wrk[j * wd] = c0;
   for (i = 1U; i < wd; i++){
-   c0  = idata_get(buf, (j * wd) + i);
-   ddf = dst -    palapp_d_flr(c0, idata_get(buf, ((j - 1U) * wd) + (i - 1U)),
-                                   idata_get(buf, ((j     ) * wd) + (i - 1U)),
-                                   idata_get(buf, ((j - 1U) * wd) + (i     )));
-   c0  = pal->col[palapp_d_avg(c0, idata_get(wrk, ((j - 1U) * wd) + (i - 1U)),
-                                   idata_get(wrk, ((j     ) * wd) + (i - 1U)),
-                                   idata_get(wrk, ((j - 1U) * wd) + (i     )), pal, ddf)].col;
-   idata_set(wrk, (j * wd) + i, c0);
+   p = (j * wd) + i;
+   if (palapp_d_keep(buf, wrk, pbuf, pwrk, p, p - wd - 1U, p - 1U, p - wd)){
+    ISTAT_INC(ISTAT_SEQ_KEEP);
+    c0  = pwrk[p];
+   }else{
+    c0  = buf[(j * wd) + i];
+    if (pbuf == NULL){
+     c1  = buf[((j     ) * wd) + (i - 1U)]; /* Left */
+     c2  = buf[((j - 1U) * wd) + (i     )]; /* Up */
+     hrc[i] = coldiff(c0, c1);
+     dvc = coldiff(c0, c2);
+     fls = coldiff(c0, buf[((j - 1U) * wd) + (i - 1U)]) +
+           hrc[i] + dvc +                   /* Left and up */
+           dvl +                            /* Up-left to left */
+           hrp[i] +                         /* Up-left to up */
+           coldiff(c1, c2);
+     dvl = dvc;
+    }else{
+     fls = palapp_d_flr(c0, buf[((j - 1U) * wd) + (i - 1U)],
+                            buf[((j     ) * wd) + (i - 1U)],
+                            buf[((j - 1U) * wd) + (i     )]);
+    }
+    c0  = palapp_d_pix(c0, wrk[((j - 1U) * wd) + (i - 1U)],
+                           wrk[((j     ) * wd) + (i - 1U)],
+                           wrk[((j - 1U) * wd) + (i     )], pal, dst, fls);
+   }
+   wrk[(j * wd) + i] = c0;
+  }
+  t   = hrp; /* Current row becomes the previous */
+  hrp = hrc;
+  hrc = t;
+ }
+}
+
+
+
+/* Ditherizes the image in buf, into wrk. */
+void palapp_dither(auint const* buf, auint* wrk, auint wd, auint hg, iquant_pal_t const* pal)
+{
+ palapp_dither_seq(buf, wrk, wd, hg, pal, NULL, NULL);
+}
+
+
+
+/* Ditherizes a stack of cnt tiles of tw x th pixels in buf (such as the
+** unique tiles of an image), into wrk. Every tile is dithered on its own,
+** its borders being image edges, so the result of a tile doesn't depend on
+** the other tiles or their order. */
+void palapp_dither_tiles(auint const* buf, auint* wrk, auint tw, auint th, auint cnt,
+                         iquant_pal_t const* pal)
+{
+ auint i;
+ auint dst = palapp_d_prep(pal, tw * th * cnt);
+
+ printf("Dither: Quantizing %u tiles (%u colors)\n", cnt, pal->cct);
+
+ for (i = 0U; i < cnt; i++){
+  palapp_d_img(&(buf[i * tw * th]), &(wrk[i * tw * th]), tw, th, pal, dst, NULL, NULL);
+ }
+
+ if (palapp_hyb != 0U){
+  printf("Dither: %u pixels dithered, %u busy pixels not dithered\n", palapp_h_dn, palapp_h_fn);
+ }
+}
+
+
+
+/* Ditherizes a frame of a sequence, like palapp_dither(). The previous
+** frame's input and output (same dimensions and palette) are passed in pbuf
+** and pwrk, pixels whose result can not differ from the previous frame's are
+** copied, giving output identical to palapp_dither(). The previous frame
+** may be NULL (first frame). */
+void palapp_dither_seq(auint const* buf, auint* wrk, auint wd, auint hg, iquant_pal_t const* pal,
+                       auint const* pbuf, auint const* pwrk)
+{
+ auint dst = palapp_d_prep(pal, wd * hg);
+
+ printf("Dither: Quantizing the image (%u colors)\n", pal->cct);
+
+ palapp_d_img(buf, wrk, wd, hg, pal, dst, pbuf, pwrk);
+
+ if (palapp_hyb != 0U){
+  printf("Dither: %u pixels dithered, %u busy pixels not dithered\n", palapp_h_dn, palapp_h_fn);
+ }
+}
+
+
+
+/* Ditherizes the image in buf into wrk by ordered dithering: every source
+** color is approximated by a mix of its nearest palette color and one of
+** that color's neighbors, the mixing ratio selecting between them by a
+** threshold matrix. Much faster than palapp_dither(), for previews and large
+** images. */
+void palapp_ordered(auint const* buf, auint* wrk, auint wd, auint hg, iquant_pal_t const* pal)
+{
+ auint i;
+ auint j;
+ auint c0;
+ auint h;
+ auint dst = palapp_d_str(pal);
+
+ printf("Ordered dither: Quantizing the image (%u colors)\n", pal->cct);
+
+ palapp_o_prep(pal);
+
+ for (j = 0U; j < hg; j++){
+  for (i = 0U; i < wd; i++){
+   c0 = buf[(j * wd) + i];
+   if (c0 != IDATA_TRANSP){
+    h  = ((c0 * 2654435761U) >> 20) & (PALAPP_OCSIZ - 1U);
+    if (palapp_o_cc[h] != c0){
+     ISTAT_INC(ISTAT_ORD_MISS);
+     palapp_o_dec(c0, pal, dst, h);
+    }else{
+     ISTAT_INC(ISTAT_ORD_HIT);
+    }
+    if (palapp_o_ct[h] > palapp_o_thr[((j & 3U) << 2) + (i & 3U)]){
+     c0 = palapp_p_col[palapp_o_cb[h]];
+    }else{
+     c0 = palapp_p_col[palapp_o_ca[h]];
+    }
+   }
+   wrk[(j * wd) + i] = c0;
   }
  }
 }
@@ -150,11 +824,41 @@ void palapp_dither(uint8 const* buf, uint8* wrk, auint wd, auint hg, iquant_pal_
 
 
 /* Applies the passed palette on the image flat */
-void palapp_flat(uint8 const* buf, uint8* wrk, auint wd, auint hg, iquant_pal_t const* pal)
+void palapp_flat(auint const* buf, auint* wrk, auint wd, auint hg, iquant_pal_t const* pal)
+{
+ palapp_flat_seq(buf, wrk, wd, hg, pal, NULL, NULL);
+}
+
+
+
+/* Applies the palette prepared with palut_init() on the image flat, by its
+** lookup table. The result is identical to palapp_flat(). */
+void palapp_flat_lut(auint const* buf, auint* wrk, auint wd, auint hg, iquant_pal_t const* pal)
+{
+ auint bsiz = wd * hg;
+ auint i;
+
+ printf("Flat: Quantizing the image by lookup table (%u colors)\n", pal->cct);
+
+ for (i = 0U; i < bsiz; i++){
+  if (buf[i] == IDATA_TRANSP){
+   wrk[i] = IDATA_TRANSP;
+  }else{
+   wrk[i] = pal->col[palut_get(buf[i])].col;
+  }
+ }
+}
+
+
+
+/* Applies the passed palette on a frame of a sequence flat, like
+** palapp_flat(), copying unchanged pixels from the previous frame's output
+** (see palapp_dither_seq()). */
+void palapp_flat_seq(auint const* buf, auint* wrk, auint wd, auint hg, iquant_pal_t const* pal,
+                     auint const* pbuf, auint const* pwrk)
 {
  auint bsiz = wd * hg;
  auint i;
- auint j;
  auint k;
  auint mi;
  auint mv;
@@ -162,23 +866,25 @@ void palapp_flat(uint8 const* buf, uint8* wrk, auint wd, auint hg, iquant_pal_t
 
  printf("Flat: Quantizing the image (%u colors)\n", pal->cct);
 
+ palapp_p_prep(pal);
+
  c0 = 0x80000000U;
  mi = 0U;
  for (i = 0U; i < bsiz; i++){
-  k = idata_get(buf, i);
-  if (c0 != k){ /* Be faster for identical colors */
-   c0 = k;
-   mi = 0U;
-   mv = 0xFFFFFFFFU;
-   for (j = 0U; j < (pal->cct); j++){ /* Get least differing color from palette */
-    k = coldiff(pal->col[j].col, c0);
-    if (k < mv){
-     mv = k;
-     mi = j;
-    }
+  k = buf[i];
+  if ((pbuf != NULL) && (k == pbuf[i])){ /* Unchanged in sequence */
+   ISTAT_INC(ISTAT_SEQ_KEEP);
+   k = pwrk[i];
+  }else if (k != IDATA_TRANSP){ /* Transparent pixels are left alone */
+   if (c0 != k){ /* Be faster for identical colors */
+    ISTAT_INC(ISTAT_FLAT_MISS);
+    c0 = k;
+    mi = palapp_p_near(c0, pal, &mv); /* Get least differing color from palette */
+   }else{
+    ISTAT_INC(ISTAT_FLAT_HIT);
    }
+   k = pal->col[mi].col;
   }
-  k = pal->col[mi].col;
-  idata_set(wrk, i, k);
+  wrk[i] = k;
  }
 }
@@ -21,7 +21,9 @@
 ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
 **
 **
-** Applies palette to the image either with ditherizing or flat.
+** Applies palette to the image either with ditherizing or flat. Fully
+** transparent pixels (IDATA_TRANSP) of the image planes are passed through
+** unchanged.
 */
 
 
@@ -32,12 +34,69 @@
 
 
 
+/* Sets the dithering strengths. The five values apply for palettes of up to
+** 8, 16, 32, 64 and above colors respectively, larger values give stronger
+** dithering (2 - 16). */
+void palapp_setdst(auint const* dst);
+
+
+/* Sets the count of candidate colors the ditherer considers for a pixel:
+** the nearest palette color and its nearest neighbors. Zero (default) gives
+** exact results, otherwise it is limited to 1 - 64, smaller counts are
+** faster, but less accurate. */
+void palapp_setcand(auint cnt);
+
+
+/* Sets the hybrid dithering threshold: pixels in busy regions, where the
+** sum of the six pairwise differences in their 2x2 neighborhood is at
+** least this, are not dithered, but get their nearest palette color, which
+** is much faster. Zero (default) dithers all pixels. */
+void palapp_sethybrid(auint thr);
+
+
 /* Ditherizes the image in buf, into wrk. */
-void palapp_dither(uint8 const* buf, uint8* wrk, auint wd, auint hg, iquant_pal_t const* pal);
+void palapp_dither(auint const* buf, auint* wrk, auint wd, auint hg, iquant_pal_t const* pal);
+
+
+/* Ditherizes a stack of cnt tiles of tw x th pixels in buf (such as the
+** unique tiles of an image), into wrk. Every tile is dithered on its own,
+** its borders being image edges, so the result of a tile doesn't depend on
+** the other tiles or their order. */
+void palapp_dither_tiles(auint const* buf, auint* wrk, auint tw, auint th, auint cnt,
+                         iquant_pal_t const* pal);
+
+
+/* Ditherizes the image in buf into wrk by ordered dithering: every source
+** color is approximated by a mix of its nearest palette color and one of
+** that color's neighbors, the mixing ratio selecting between them by a
+** threshold matrix. Much faster than palapp_dither(), for previews and large
+** images. */
+void palapp_ordered(auint const* buf, auint* wrk, auint wd, auint hg, iquant_pal_t const* pal);
 
 
 /* Applies the passed palette on the image flat */
-void palapp_flat(uint8 const* buf, uint8* wrk, auint wd, auint hg, iquant_pal_t const* pal);
+void palapp_flat(auint const* buf, auint* wrk, auint wd, auint hg, iquant_pal_t const* pal);
+
+
+/* Applies the palette prepared with palut_init() on the image flat, by its
+** lookup table. The result is identical to palapp_flat(). */
+void palapp_flat_lut(auint const* buf, auint* wrk, auint wd, auint hg, iquant_pal_t const* pal);
+
+
+/* Ditherizes a frame of a sequence, like palapp_dither(). The previous
+** frame's input and output (same dimensions and palette) are passed in pbuf
+** and pwrk, pixels whose result can not differ from the previous frame's are
+** copied, giving output identical to palapp_dither(). The previous frame
+** may be NULL (first frame). */
+void palapp_dither_seq(auint const* buf, auint* wrk, auint wd, auint hg, iquant_pal_t const* pal,
+                       auint const* pbuf, auint const* pwrk);
+
+
+/* Applies the passed palette on a frame of a sequence flat, like
+** palapp_flat(), copying unchanged pixels from the previous frame's output
+** (see palapp_dither_seq()). */
+void palapp_flat_seq(auint const* buf, auint* wrk, auint wd, auint hg, iquant_pal_t const* pal,
+                     auint const* pbuf, auint const* pwrk);
 
 
 #endif
@@ -23,8 +23,21 @@
 
 
 #include "palgen.h"
-#include "idata.h"
 #include "coldepth.h"
+#include "idata.h"
+
+
+
+/* Colors and occurrences being collected by palgen(), in separate arrays so
+** the search for a color only loads colors */
+static auint palgen_col[PALGEN_MAX];
+static auint palgen_occ[PALGEN_MAX];
+
+/* Hash table size for palgen_exact() (power of 2, at least twice of 256) */
+#define PALGEN_HSIZ 1024U
+
+/* Palette index + 1 by hash (zero: empty slot) for palgen_exact() */
+static uint16 palgen_htb[PALGEN_HSIZ];
 
 
 
@@ -32,31 +45,86 @@
 ** targeting a given depth. Uses the mct member to limit color count.
 ** Returns nonzero if successful, zero otherwise (image has more colors than
 ** fitting in the palette). */
-auint palgen(uint8 const* buf, auint bsiz, iquant_pal_t* pal, auint depth)
+auint palgen(auint const* buf, auint bsiz, iquant_pal_t* pal, auint depth)
 {
  auint i;
  auint j;
  auint c;
+ auint cct = 0U;
+ auint mct = (pal->mct < PALGEN_MAX) ? pal->mct : PALGEN_MAX;
+ auint r = 1U;
 
  pal->ocs = bsiz;
- pal->cct = 0U;
 
- for (i = 0U; i < bsiz; i++){ /* Collect */
-  c = coldepth(idata_get(buf, i), depth);
-  for (j = 0U; j < (pal->cct); j++){
-   if (c == (pal->col[j].col)){ /* Already collected color */
-    pal->col[j].occ++;
+ for (i = 0U; (i < bsiz) && (r != 0U); i++){ /* Collect */
+  c = coldepth(buf[i], depth);
+  j = 0U;
+  while ( ((j + 4U) <= cct) &&   /* Four colors at once while possible */
+          ((c != palgen_col[j     ]) &
+           (c != palgen_col[j + 1U]) &
+           (c != palgen_col[j + 2U]) &
+           (c != palgen_col[j + 3U])) ){
+   j += 4U;
+  }
+  for (     ; j < cct; j++){
+   if (c == palgen_col[j]){ /* Already collected color */
+    palgen_occ[j]++;
     break;
    }
   }
-  if ((j == (pal->cct)) && (j != (pal->mct))){ /* One more color */
-   pal->col[j].col = c;
-   pal->col[j].occ = 1U;
-   pal->cct++;
-  }else if (j == (pal->mct)){
-   return 0U;
+  if ((j == cct) && (j != mct)){ /* One more color */
+   palgen_col[j] = c;
+   palgen_occ[j] = 1U;
+   cct++;
+  }else if (j == mct){
+   r = 0U;
   }
  }
 
+ for (j = 0U; j < cct; j++){
+  pal->col[j].col = palgen_col[j];
+  pal->col[j].occ = palgen_occ[j];
+ }
+ pal->cct = cct;
+
+ return r;
+}
+
+
+
+/* Collects the distinct colors of the passed image data with occurrence
+** data (at most 256, limited further by the mct member), by a hash lookup,
+** so it is fast even when giving up on an image with many colors. Fully
+** transparent pixels are skipped. Returns nonzero if successful, zero
+** otherwise (image has more colors than fitting in the palette). */
+auint palgen_exact(auint const* buf, auint bsiz, iquant_pal_t* pal)
+{
+ auint i;
+ auint h;
+ auint c;
+ auint m = (pal->mct < 256U) ? pal->mct : 256U;
+
+ memset(palgen_htb, 0U, sizeof(palgen_htb));
+ pal->ocs = 0U;
+ pal->cct = 0U;
+ for (i = 0U; i < bsiz; i++){
+  c = buf[i];
+  if (c != IDATA_TRANSP){
+   h = ((c * 2654435761U) >> 22) & (PALGEN_HSIZ - 1U);
+   while ( (palgen_htb[h] != 0U) &&
+           (pal->col[palgen_htb[h] - 1U].col != c) ){
+    h = (h + 1U) & (PALGEN_HSIZ - 1U);
+   }
+   if (palgen_htb[h] == 0U){ /* One more color */
+    if ((pal->cct) == m){ return 0U; }
+    pal->col[pal->cct].col = c;
+    pal->col[pal->cct].occ = 0U;
+    pal->cct++;
+    palgen_htb[h] = pal->cct;
+   }
+   pal->col[palgen_htb[h] - 1U].occ++;
+   pal->ocs++;
+  }
+ }
  return 1U;
 }
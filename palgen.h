@@ -29,11 +29,23 @@
 
 
 
+/* Maximal color count palgen() can collect */
+#define PALGEN_MAX 16384U
+
+
 /* Generates palette from the passed image data with occurrence data,
-** targeting a given depth. Uses the mct member to limit color count.
-** Returns nonzero if successful, zero otherwise (image has more colors than
-** fitting in the palette). */
-auint palgen(uint8 const* buf, auint bsiz, iquant_pal_t* pal, auint depth);
+** targeting a given depth. Uses the mct member to limit color count (at
+** most PALGEN_MAX). Returns nonzero if successful, zero otherwise (image
+** has more colors than fitting in the palette). */
+auint palgen(auint const* buf, auint bsiz, iquant_pal_t* pal, auint depth);
+
+
+/* Collects the distinct colors of the passed image data with occurrence
+** data (at most 256, limited further by the mct member), by a hash lookup,
+** so it is fast even when giving up on an image with many colors. Fully
+** transparent pixels are skipped. Returns nonzero if successful, zero
+** otherwise (image has more colors than fitting in the palette). */
+auint palgen_exact(auint const* buf, auint bsiz, iquant_pal_t* pal);
 
 
 #endif
@@ -0,0 +1,277 @@
+/**
+**  \file
+**  \brief     InsaniQuant fixed palette lookup table
+**  \author    Sandor Zsuga (Jubatian)
+**  \copyright 2013 - 2017, GNU General Public License version 2 or any later
+**             version, see LICENSE
+**  \date      2017.03.31
+**
+**
+** This program is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 2 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+**
+*/
+
+
+
+#include "palut.h"
+#include "coldiff.h"
+#include "ihash.h"
+#include "istat.h"
+#include "version.h"
+#ifdef TARGET_LINUX
+#include <sys/mman.h>
+#endif
+
+
+
+/* Table file magic and format version */
+#define PALUT_MAG  0x014C5149U /* "IQL", 0x01 */
+
+/* Header size in bytes */
+#define PALUT_HSIZ 16U
+
+/* Valid entry bitmap size in bytes */
+#define PALUT_VSIZ ((256U * 256U * 256U) >> 3)
+
+/* Index table size in bytes */
+#define PALUT_ISIZ (256U * 256U * 256U)
+
+/* Total table size in bytes (as in the file) */
+#define PALUT_TSIZ (PALUT_HSIZ + PALUT_VSIZ + PALUT_ISIZ)
+
+/* Table buffer (header, valid bitmap, indices) */
+static uint8* palut_buf = NULL;
+
+/* Valid entry bitmap and indices within the table buffer */
+static uint8* palut_vld;
+static uint8* palut_idx;
+
+/* Whether the table buffer is memory mapped */
+static auint  palut_map;
+
+/* Whether any entries were calculated since loading */
+static auint  palut_dty;
+
+/* Palette the table belongs to */
+static iquant_pal_t const* palut_pal;
+
+/* Table file name, NULL if not persisted */
+static char const* palut_fnm;
+
+
+
+/* Stores a 32 bit little endian value in the table buffer */
+static void palut_wr32(uint8* dst, auint val)
+{
+ dst[0] = (val      ) & 0xFFU;
+ dst[1] = (val >>  8) & 0xFFU;
+ dst[2] = (val >> 16) & 0xFFU;
+ dst[3] = (val >> 24) & 0xFFU;
+}
+
+
+
+/* Loads a 32 bit little endian value from the table buffer */
+static auint palut_rd32(uint8 const* src)
+{
+ return ((auint)(src[0])      ) |
+        ((auint)(src[1]) <<  8) |
+        ((auint)(src[2]) << 16) |
+        ((auint)(src[3]) << 24);
+}
+
+
+
+/* Attempts to load the table from its file into the table buffer. Returns
+** nonzero on success. */
+static auint palut_load(uint64 key)
+{
+ FILE*  f;
+ uint8* buf = NULL;
+ auint  r = 0U;
+
+ f = fopen(palut_fnm, "rb");
+ if (f == NULL){ return 0U; }
+
+#ifdef TARGET_LINUX
+ /* Private mapping: entries calculated later don't alter the file */
+ if (fseek(f, 0L, SEEK_END) == 0){
+  if (ftell(f) == (long)(PALUT_TSIZ)){
+   buf = mmap(NULL, PALUT_TSIZ, PROT_READ | PROT_WRITE, MAP_PRIVATE, fileno(f), 0);
+   if (buf == MAP_FAILED){ buf = NULL; }
+   else                  { palut_map = 1U; }
+  }
+ }
+#endif
+ if (buf == NULL){
+  buf = malloc(PALUT_TSIZ);
+  if (buf != NULL){
+   if ( (fseek(f, 0L, SEEK_SET) != 0) ||
+        (fread(buf, 1U, PALUT_TSIZ, f) != PALUT_TSIZ) ){
+    free(buf);
+    buf = NULL;
+   }
+  }
+ }
+
+ fclose(f);
+
+ if (buf != NULL){
+  r = (palut_rd32(&(buf[ 0])) == PALUT_MAG) &&
+      (palut_rd32(&(buf[ 4])) == (auint)(key & 0xFFFFFFFFU)) &&
+      (palut_rd32(&(buf[ 8])) == (auint)(key >> 32)) &&
+      (palut_rd32(&(buf[12])) == palut_pal->cct);
+  if (!r){
+#ifdef TARGET_LINUX
+   if (palut_map){ munmap(buf, PALUT_TSIZ); }
+   else          { free(buf); }
+#else
+   free(buf);
+#endif
+   palut_map = 0U;
+   buf = NULL;
+  }
+ }
+
+ palut_buf = buf;
+ return r;
+}
+
+
+
+/* Prepares the lookup table for a palette (of up to 256 colors). If a file
+** name is given, the table is loaded from it if it matches the palette. The
+** palette must remain valid while the table is in use. Returns nonzero on
+** success. */
+auint palut_init(iquant_pal_t const* pal, char const* fnam)
+{
+ uint64 key = IHASH_INIT;
+ auint  i;
+
+ if (((pal->cct) == 0U) || ((pal->cct) > 256U)){ return 0U; }
+
+ palut_pal = pal;
+ palut_fnm = fnam;
+ palut_map = 0U;
+ palut_dty = 0U;
+ palut_buf = NULL;
+
+ key = ihash_buf(key, IQUANT_VERSION, strlen(IQUANT_VERSION));
+ for (i = 0U; i < (pal->cct); i++){
+  key = ihash_val(key, pal->col[i].col);
+ }
+
+ if (fnam != NULL){
+  if (palut_load(key)){
+   printf("Lookup table: Loaded from %s\n", fnam);
+  }
+ }
+
+ if (palut_buf == NULL){ /* New, empty table */
+  palut_buf = malloc(PALUT_TSIZ);
+  if (palut_buf == NULL){ return 0U; }
+  palut_wr32(&(palut_buf[ 0]), PALUT_MAG);
+  palut_wr32(&(palut_buf[ 4]), (auint)(key & 0xFFFFFFFFU));
+  palut_wr32(&(palut_buf[ 8]), (auint)(key >> 32));
+  palut_wr32(&(palut_buf[12]), pal->cct);
+  memset(&(palut_buf[PALUT_HSIZ]), 0U, PALUT_VSIZ);
+ }
+
+ palut_vld = &(palut_buf[PALUT_HSIZ]);
+ palut_idx = &(palut_buf[PALUT_HSIZ + PALUT_VSIZ]);
+
+ return 1U;
+}
+
+
+
+/* Returns the palette index of the color nearest to a 24 bit color. */
+auint palut_get(auint col)
+{
+ auint i;
+ auint k;
+ auint mi;
+ auint mv;
+
+ col &= 0xFFFFFFU;
+
+ if ((palut_vld[col >> 3] & (1U << (col & 0x7U))) != 0U){
+  ISTAT_INC(ISTAT_FLAT_HIT);
+  return palut_idx[col];
+ }
+
+ ISTAT_INC(ISTAT_FLAT_MISS);
+ mi = 0U;
+ mv = 0xFFFFFFFFU;
+ for (i = 0U; i < (palut_pal->cct); i++){ /* Same search as palapp_flat() */
+  k = coldiff(palut_pal->col[i].col, col);
+  if (k < mv){
+   mv = k;
+   mi = i;
+  }
+ }
+
+ palut_idx[col] = mi;
+ palut_vld[col >> 3] |= 1U << (col & 0x7U);
+ palut_dty = 1U;
+ return mi;
+}
+
+
+
+/* Releases the lookup table, writing it back into its file first if any
+** entries were calculated. Returns nonzero if this succeeded (or there was
+** nothing to write). */
+auint palut_free(void)
+{
+ FILE* f;
+ char* tnm;
+ auint r = 1U;
+
+ if (palut_buf == NULL){ return 1U; }
+
+ /* The file may be mapped, so write a new one, and replace the old one
+ ** with it (on Linux the mapping remains valid on the old file). */
+
+ if ((palut_fnm != NULL) && (palut_dty)){
+  r = 0U;
+  tnm = malloc(strlen(palut_fnm) + 5U);
+  if (tnm != NULL){
+   strcpy(tnm, palut_fnm);
+   strcat(tnm, ".tmp");
+   f = fopen(tnm, "wb");
+   if (f != NULL){
+    r = (fwrite(palut_buf, 1U, PALUT_TSIZ, f) == PALUT_TSIZ);
+    if (fclose(f)){ r = 0U; }
+    if (r){
+     remove(palut_fnm);
+     r = (rename(tnm, palut_fnm) == 0);
+    }
+    if (!r){ remove(tnm); }
+   }
+   free(tnm);
+  }
+ }
+
+#ifdef TARGET_LINUX
+ if (palut_map){ munmap(palut_buf, PALUT_TSIZ); }
+ else          { free(palut_buf); }
+#else
+ free(palut_buf);
+#endif
+ palut_buf = NULL;
+ palut_map = 0U;
+
+ return r;
+}
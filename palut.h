@@ -0,0 +1,66 @@
+/**
+**  \file
+**  \brief     InsaniQuant fixed palette lookup table
+**  \author    Sandor Zsuga (Jubatian)
+**  \copyright 2013 - 2017, GNU General Public License version 2 or any later
+**             version, see LICENSE
+**  \date      2017.03.31
+**
+**
+** This program is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 2 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+**
+**
+**
+** Maps colors onto a fixed (target) palette by a lookup table covering every
+** 24 bit color. Entries are calculated on first use, so only the colors
+** actually occurring cost a palette search. The table may be persisted in a
+** file, then later runs with the same palette reuse it (memory mapping it
+** where possible).
+**
+** Table file format:
+** - Magic: "IQL" and a format version byte (32 bit little endian).
+** - Key: 64 bit hash of the program version (as the color difference
+**   calculation may change between versions) and the palette colors, low
+**   32 bits first.
+** - Palette color count (32 bit little endian).
+** - Valid entry bitmap, one bit for every 24 bit color (2 MBytes).
+** - Palette index for every 24 bit color (16 MBytes).
+*/
+
+
+#ifndef PALUT_H
+#define PALUT_H
+
+#include "types.h"
+
+
+
+/* Prepares the lookup table for a palette (of up to 256 colors). If a file
+** name is given, the table is loaded from it if it matches the palette. The
+** palette must remain valid while the table is in use. Returns nonzero on
+** success. */
+auint palut_init(iquant_pal_t const* pal, char const* fnam);
+
+
+/* Returns the palette index of the color nearest to a 24 bit color. */
+auint palut_get(auint col);
+
+
+/* Releases the lookup table, writing it back into its file first if any
+** entries were calculated. Returns nonzero if this succeeded (or there was
+** nothing to write). */
+auint palut_free(void);
+
+
+#endif
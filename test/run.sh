@@ -0,0 +1,100 @@
+#!/bin/bash
+#
+# Golden output regression test. Quantizes the images of the test corpus
+# with a set of parameters (color counts, depths, dithering and the various
+# modes), and compares the digests of the palettes and output images against
+# the stored ones (golden.txt) byte for byte. Exits with failure on any
+# mismatch.
+#
+# Parameters:
+# - The insaniquant executable to test
+# - (Optional) '-u' to rewrite golden.txt with the current results, after an
+#   intended output change
+#
+
+if [ "$#" -lt 1 ] || [ ! -x "$1" ]; then
+    echo "Needs the insaniquant executable to test as parameter"
+    exit 1
+fi
+BIN=$1
+DIR=$(dirname "$0")
+TMP=$(mktemp -d)
+trap 'rm -r -f "$TMP"' EXIT
+
+# Runs one test: image, width, height, then the rest of the parameters
+# after the output file name. Outputs the parameters and the digests on a
+# line (or FAILED if the program failed), without the directories of the
+# file name parameters.
+run(){
+    img=$1
+    wd=$2
+    hg=$3
+    cnt=$4
+    shift 4
+    "$BIN" "$DIR/$img" $wd $hg $cnt "$TMP/out.rgb" "$@" --hash >"$TMP/log.txt" 2>&1
+    res=$?
+    par="$*"
+    par=${par//$TMP\//}
+    par=${par//$DIR\//}
+    if [ "$res" -ne 0 ]; then
+        echo "$img $cnt $par FAILED"
+    else
+        echo "$img $cnt $par" $(grep "digest" "$TMP/log.txt" | sed "s/.*: //")
+    fi
+}
+
+tests(){
+    run grad.rgb 64 48 2
+    run grad.rgb 64 48 16
+    run grad.rgb 64 48 16 d
+    run grad.rgb 64 48 16 o
+    run grad.rgb 64 48 64 444 d
+    run grad.rgb 64 48 256 332 d
+    run photo.rgb 64 64 8 4 d
+    run photo.rgb 64 64 32
+    run photo.rgb 64 64 32 d
+    run photo.rgb 64 64 64 555 o
+    run photo.rgb 64 64 256 d
+    run photo.rgb 64 64 32 d --fast
+    run photo.rgb 64 64 32 d --best
+    run photo.rgb 64 64 32 d --cand=4
+    run photo.rgb 64 64 32 d --hybrid=2048
+    run photo.rgb 64 64 16,32,64 d
+    run photo.rgb 64 64 16 --variants=8,444d,332o
+    run photo.rgb 64 64 32 d --seed="$DIR/few.rgb"
+    run photo.rgb 64 64 16 d --palette="$DIR/few.rgb"
+    run photo.rgb 64 64 16 --palette="$DIR/few.rgb" --lut="$TMP/lut.iql"
+    run photo.rgb 64 64 16 --palette="$DIR/few.rgb" --lut="$TMP/lut.iql"
+    run photo.rgb 64 64 32 d --hcache="$TMP/hc.iqh"
+    run photo.rgb 64 64 32 d --hcache="$TMP/hc.iqh"
+    run photo.rgb 64 64 32 d --cache="$TMP/rc"
+    run photo.rgb 64 64 32 d --cache="$TMP/rc"
+    run photo.rgb 64 64 16 --tiles=16,16,4
+    run few.rgb 48 32 16
+    run few.rgb 48 32 16 d
+    run few.rgb 48 32 8 d
+    run few.rgb 48 32 16 222
+    run sheet.rgb 64 64 16
+    run sheet.rgb 64 64 16 d --dedup=16,16
+    run sheet.rgb 64 64 16 o --dedup=16,16
+    run sprite.rgba 32 32 8 --rgba
+    run sprite.rgba 32 32 16 d --rgba
+    run sprite.rgba 32 32 16 o --rgba
+    echo "$DIR/grad.rgb 64 48 $TMP/o1.rgb" >"$TMP/list.txt"
+    echo "$DIR/few.rgb 48 32 $TMP/o2.rgb" >>"$TMP/list.txt"
+    run photo.rgb 64 64 32 d --shared="$TMP/list.txt"
+    run photo.rgb 64 64 32 --shared="$TMP/list.txt" --sequence
+}
+
+if [ "$2" = "-u" ]; then
+    tests >"$DIR/golden.txt"
+    echo "Rewrote $DIR/golden.txt"
+    exit 0
+fi
+tests >"$TMP/result.txt"
+if diff "$DIR/golden.txt" "$TMP/result.txt"; then
+    echo "All tests passed"
+    exit 0
+fi
+echo "Output differs from golden.txt"
+exit 1
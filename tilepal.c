@@ -0,0 +1,461 @@
+/**
+**  \file
+**  \brief     InsaniQuant tiled multi-palette quantization
+**  \author    Sandor Zsuga (Jubatian)
+**  \copyright 2013 - 2017, GNU General Public License version 2 or any later
+**             version, see LICENSE
+**  \date      2017.03.31
+**
+**
+** This program is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 2 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+
+#include "tilepal.h"
+#include "coldiff.h"
+#include "depthred.h"
+#include "mquant.h"
+#include "idata.h"
+#include "istat.h"
+#include "ihash.h"
+
+
+
+/* Maximal count of clustering iterations (palette generation and tile
+** assignment rounds) */
+#define TILEPAL_ITR 4U
+
+/* Mean color of each tile (opaque pixels) */
+static auint tilepal_tmc[TILEPAL_TMAX];
+
+/* Count of opaque pixels in each tile */
+static auint tilepal_tpx[TILEPAL_TMAX];
+
+/* Seeding: difference of each tile's mean color to the nearest seed */
+static auint tilepal_tmd[TILEPAL_TMAX];
+
+/* Duplicate elimination hash table size (power of 2) */
+#define TILEPAL_HSIZ (TILEPAL_TMAX * 2U)
+
+/* Duplicate elimination: unique tile index + 1 by hash (zero: empty slot) */
+static auint tilepal_htb[TILEPAL_HSIZ];
+
+
+
+/* Returns the count of tiles covering an image (tiles on the right and the
+** bottom edge may be partial). The tiles are in row-major order. */
+auint tilepal_cnt(auint wd, auint hg, auint tw, auint th)
+{
+ return ((wd + tw - 1U) / tw) * ((hg + th - 1U) / th);
+}
+
+
+
+/* Calculates the bounds of a tile: the top left corner (x0, y0) and the
+** bottom right corner, exclusive (x1, y1). */
+static void tilepal_rect(auint t, auint wd, auint hg, auint tw, auint th,
+                         auint* x0, auint* y0, auint* x1, auint* y1)
+{
+ auint tx = (wd + tw - 1U) / tw;
+
+ *x0 = (t % tx) * tw;
+ *y0 = (t / tx) * th;
+ *x1 = *x0 + tw;
+ *y1 = *y0 + th;
+ if (*x1 > wd){ *x1 = wd; }
+ if (*y1 > hg){ *y1 = hg; }
+}
+
+
+
+/* Returns the index of the palette color nearest to col, its difference in
+** dif. */
+static auint tilepal_near(auint col, iquant_pal_t const* pal, auint* dif)
+{
+ auint i;
+ auint k;
+ auint mi = 0U;
+ auint mv = 0xFFFFFFFFU;
+
+ for (i = 0U; i < (pal->cct); i++){
+  k = coldiff(pal->col[i].col, col);
+  if (k < mv){
+   mv = k;
+   mi = i;
+  }
+ }
+
+ *dif = mv;
+ return mi;
+}
+
+
+
+/* Calculates the error of mapping a tile with a palette: the sum of the
+** differences of its opaque pixels to their nearest palette colors. */
+static uint64 tilepal_err(auint const* buf, auint wd, auint hg, auint tw, auint th,
+                          auint t, iquant_pal_t const* pal)
+{
+ auint  x0;
+ auint  y0;
+ auint  x1;
+ auint  y1;
+ auint  x;
+ auint  y;
+ auint  c0 = 0x80000000U;
+ auint  col;
+ auint  dif = 0U;
+ uint64 r = 0U;
+
+ tilepal_rect(t, wd, hg, tw, th, &x0, &y0, &x1, &y1);
+ for (y = y0; y < y1; y++){
+  for (x = x0; x < x1; x++){
+   col = buf[(y * wd) + x];
+   if (col != IDATA_TRANSP){
+    if (col != c0){ /* Be faster for identical colors */
+     c0 = col;
+     (void)(tilepal_near(col, pal, &dif));
+    }
+    r += dif;
+   }
+  }
+ }
+
+ return r;
+}
+
+
+
+/* Generates the palettes of gcnt tile groups (at most cols colors of pdep
+** depth each) for the image plane buf, and the group of each tile in map.
+** The wrk plane (same size as buf) and pal (MQUANT_COLS colors) are used as
+** work area, drc is the depth reduction target. Groups receiving no tiles
+** get an empty palette. Fully transparent pixels are not considered. */
+void tilepal(auint const* buf, auint* wrk, auint wd, auint hg, auint tw, auint th,
+             iquant_pal_t* pal, auint drc, auint cols, auint pdep,
+             iquant_pal_t* gpal, auint gcnt, uint8* map)
+{
+ auint  tcnt = tilepal_cnt(wd, hg, tw, th);
+ auint  sd[TILEPAL_GMAX];
+ auint  ns;
+ auint  t;
+ auint  g;
+ auint  x0;
+ auint  y0;
+ auint  x1;
+ auint  y1;
+ auint  x;
+ auint  y;
+ auint  c;
+ auint  k;
+ auint  mi;
+ auint  mv;
+ auint  it;
+ auint  cr;
+ auint  cg;
+ auint  cb;
+ uint64 gr;
+ uint64 gg;
+ uint64 gb;
+ uint64 gn;
+ uint64 e;
+ uint64 me;
+
+ printf("Tiles: %u tiles of %u x %u px, %u groups of %u colors\n", tcnt, tw, th, gcnt, cols);
+
+ /* Mean colors of the tiles, and of the whole image */
+
+ gr = 0U;
+ gg = 0U;
+ gb = 0U;
+ gn = 0U;
+ for (t = 0U; t < tcnt; t++){
+  tilepal_rect(t, wd, hg, tw, th, &x0, &y0, &x1, &y1);
+  cr = 0U;
+  cg = 0U;
+  cb = 0U;
+  k  = 0U;
+  for (y = y0; y < y1; y++){
+   for (x = x0; x < x1; x++){
+    c = buf[(y * wd) + x];
+    if (c != IDATA_TRANSP){
+     cr += (c >> 16) & 0xFFU;
+     cg += (c >>  8) & 0xFFU;
+     cb += (c      ) & 0xFFU;
+     k  ++;
+    }
+   }
+  }
+  tilepal_tpx[t] = k;
+  tilepal_tmc[t] = 0U;
+  if (k != 0U){
+   tilepal_tmc[t] = (((cr + (k >> 1)) / k) << 16) |
+                    (((cg + (k >> 1)) / k) <<  8) |
+                    (((cb + (k >> 1)) / k)      );
+  }
+  gr += cr;
+  gg += cg;
+  gb += cb;
+  gn += k;
+ }
+ if (gn != 0U){
+  gr = (gr + (gn >> 1)) / gn;
+  gg = (gg + (gn >> 1)) / gn;
+  gb = (gb + (gn >> 1)) / gn;
+ }
+
+ /* Farthest point seeding: the first seed is the tile nearest to the mean
+ ** of the image, every further seed is the tile farthest from the seeds so
+ ** far. Stops early if the tiles run out of distinct mean colors. */
+
+ ns = 0U;
+ mi = 0U;
+ mv = 0xFFFFFFFFU;
+ for (t = 0U; t < tcnt; t++){
+  if (tilepal_tpx[t] != 0U){
+   k = coldiff(tilepal_tmc[t], (auint)((gr << 16) | (gg << 8) | gb));
+   if (k < mv){
+    mv = k;
+    mi = t;
+   }
+  }
+ }
+ if (mv != 0xFFFFFFFFU){
+  sd[0] = tilepal_tmc[mi];
+  ns    = 1U;
+  for (t = 0U; t < tcnt; t++){
+   tilepal_tmd[t] = 0U;
+   if (tilepal_tpx[t] != 0U){ tilepal_tmd[t] = coldiff(tilepal_tmc[t], sd[0]); }
+  }
+ }
+ while ((ns != 0U) && (ns < gcnt)){
+  mi = 0U;
+  mv = 0U;
+  for (t = 0U; t < tcnt; t++){
+   if (tilepal_tmd[t] > mv){
+    mv = tilepal_tmd[t];
+    mi = t;
+   }
+  }
+  if (mv == 0U){ break; } /* All tiles are on a seed */
+  sd[ns] = tilepal_tmc[mi];
+  for (t = 0U; t < tcnt; t++){
+   k = coldiff(tilepal_tmc[t], sd[ns]);
+   if (k < tilepal_tmd[t]){ tilepal_tmd[t] = k; }
+  }
+  ns ++;
+ }
+
+ for (t = 0U; t < tcnt; t++){
+  map[t] = 0U;
+  if (tilepal_tpx[t] != 0U){
+   mv = 0xFFFFFFFFU;
+   for (g = 0U; g < ns; g++){
+    k = coldiff(tilepal_tmc[t], sd[g]);
+    if (k < mv){
+     mv = k;
+     map[t] = g;
+    }
+   }
+  }
+ }
+
+ /* Iterate: generate the palette of each group from the pixels of its
+ ** tiles, then move every tile to the group mapping it with the least
+ ** error. The final assignment is always by the final palettes. */
+
+ for (it = 0U; it < TILEPAL_ITR; it++){
+
+  for (g = 0U; g < gcnt; g++){
+   k = 0U;
+   for (t = 0U; t < tcnt; t++){
+    if ((map[t] == g) && (tilepal_tpx[t] != 0U)){
+     tilepal_rect(t, wd, hg, tw, th, &x0, &y0, &x1, &y1);
+     for (y = y0; y < y1; y++){
+      for (x = x0; x < x1; x++){
+       if (buf[(y * wd) + x] != IDATA_TRANSP){
+        wrk[k] = buf[(y * wd) + x];
+        k ++;
+       }
+      }
+     }
+    }
+   }
+   gpal[g].cct = 0U;
+   gpal[g].ocs = 0U;
+   if (k != 0U){
+    printf("Tiles: Group %u palette from %u px\n", g, k);
+    depthred(wrk, k, pal, drc);
+    mquant_prep(pal);
+    mquant_multi(pal, &cols, 1U, pdep, &(gpal[g]));
+   }
+  }
+
+  k = 0U;
+  for (t = 0U; t < tcnt; t++){
+   if (tilepal_tpx[t] != 0U){
+    mi = map[t];
+    me = 0xFFFFFFFFFFFFFFFFULL;
+    for (g = 0U; g < gcnt; g++){
+     if (gpal[g].cct != 0U){
+      e = tilepal_err(buf, wd, hg, tw, th, t, &(gpal[g]));
+      if (e < me){
+       me = e;
+       mi = g;
+      }
+     }
+    }
+    if (mi != map[t]){
+     map[t] = mi;
+     k ++;
+    }
+   }
+  }
+  printf("Tiles: Iteration %u, %u tiles moved\n", it + 1U, k);
+  if (k == 0U){ break; }
+
+ }
+}
+
+
+
+/* Applies the group palettes on the image plane buf flat, into wrk, each
+** tile by its group's palette. The index of each pixel's color within its
+** palette is written into idx (fully transparent pixels get zero). */
+void tilepal_apply(auint const* buf, auint* wrk, uint8* idx, auint wd, auint hg, auint tw, auint th,
+                   iquant_pal_t const* gpal, uint8 const* map)
+{
+ auint tcnt = tilepal_cnt(wd, hg, tw, th);
+ auint t;
+ auint x0;
+ auint y0;
+ auint x1;
+ auint y1;
+ auint x;
+ auint y;
+ auint p;
+ auint c0;
+ auint mi;
+ auint dif;
+ iquant_pal_t const* pal;
+
+ printf("Tiles: Quantizing the image (%u tiles)\n", tcnt);
+
+ for (t = 0U; t < tcnt; t++){
+  pal = &(gpal[map[t]]);
+  c0  = 0x80000000U;
+  mi  = 0U;
+  tilepal_rect(t, wd, hg, tw, th, &x0, &y0, &x1, &y1);
+  for (y = y0; y < y1; y++){
+   for (x = x0; x < x1; x++){
+    p = (y * wd) + x;
+    if (buf[p] == IDATA_TRANSP){
+     wrk[p] = IDATA_TRANSP;
+     idx[p] = 0U;
+    }else{
+     if (c0 != buf[p]){ /* Be faster for identical colors */
+      ISTAT_INC(ISTAT_FLAT_MISS);
+      c0 = buf[p];
+      mi = tilepal_near(c0, pal, &dif);
+     }else{
+      ISTAT_INC(ISTAT_FLAT_HIT);
+     }
+     wrk[p] = pal->col[mi].col;
+     idx[p] = mi;
+    }
+   }
+  }
+ }
+}
+
+
+
+/* Collects the unique tiles of the image plane buf into the atlas abuf, and
+** the index of every tile's unique tile into uni. Partial tiles on the
+** edges are padded by repeating their last column and row. Returns the
+** count of unique tiles. */
+auint tilepal_dedup(auint const* buf, auint wd, auint hg, auint tw, auint th,
+                    auint* abuf, auint* uni)
+{
+ auint  tcnt = tilepal_cnt(wd, hg, tw, th);
+ auint  tpx  = tw * th;
+ auint  ucnt = 0U;
+ auint  t;
+ auint  x0;
+ auint  y0;
+ auint  x1;
+ auint  y1;
+ auint  x;
+ auint  y;
+ auint  h;
+ auint* dst;
+ uint64 key;
+
+ memset(tilepal_htb, 0U, sizeof(tilepal_htb));
+
+ /* Every tile is copied into the next free atlas slot, and only kept there
+ ** if no identical tile was found by its hash */
+
+ for (t = 0U; t < tcnt; t++){
+  tilepal_rect(t, wd, hg, tw, th, &x0, &y0, &x1, &y1);
+  dst = &(abuf[ucnt * tpx]);
+  for (y = 0U; y < th; y++){
+   for (x = 0U; x < tw; x++){
+    dst[(y * tw) + x] = buf[( (((y0 + y) < y1) ? (y0 + y) : (y1 - 1U)) * wd ) +
+                            ( (((x0 + x) < x1) ? (x0 + x) : (x1 - 1U))      )];
+   }
+  }
+  key = ihash_buf(IHASH_INIT, dst, tpx * sizeof(auint));
+  h   = (auint)(key ^ (key >> 32)) & (TILEPAL_HSIZ - 1U);
+  while ( (tilepal_htb[h] != 0U) &&
+          (memcmp(&(abuf[(tilepal_htb[h] - 1U) * tpx]), dst, tpx * sizeof(auint)) != 0) ){
+   h = (h + 1U) & (TILEPAL_HSIZ - 1U);
+  }
+  if (tilepal_htb[h] == 0U){ /* New unique tile */
+   ucnt ++;
+   tilepal_htb[h] = ucnt;
+  }
+  uni[t] = tilepal_htb[h] - 1U;
+ }
+
+ printf("Dedup: %u tiles of %u x %u px, %u unique\n", tcnt, tw, th, ucnt);
+
+ return ucnt;
+}
+
+
+
+/* Copies the processed unique tiles of the atlas awrk to every occurrence
+** of them in the image plane wrk. */
+void tilepal_scatter(auint const* awrk, auint* wrk, auint wd, auint hg, auint tw, auint th,
+                     auint const* uni)
+{
+ auint tcnt = tilepal_cnt(wd, hg, tw, th);
+ auint t;
+ auint x0;
+ auint y0;
+ auint x1;
+ auint y1;
+ auint y;
+ auint const* src;
+
+ for (t = 0U; t < tcnt; t++){
+  tilepal_rect(t, wd, hg, tw, th, &x0, &y0, &x1, &y1);
+  src = &(awrk[uni[t] * tw * th]);
+  for (y = y0; y < y1; y++){
+   memcpy(&(wrk[(y * wd) + x0]), &(src[(y - y0) * tw]), (x1 - x0) * sizeof(auint));
+  }
+ }
+}
@@ -0,0 +1,92 @@
+/**
+**  \file
+**  \brief     InsaniQuant tiled multi-palette quantization
+**  \author    Sandor Zsuga (Jubatian)
+**  \copyright 2013 - 2017, GNU General Public License version 2 or any later
+**             version, see LICENSE
+**  \date      2017.03.31
+**
+**
+** This program is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 2 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+**
+**
+** Quantizes an image for targets with per-tile palettes: the image is split
+** into tiles, the tiles are clustered into a given count of groups, and a
+** palette is generated for each group. Every tile uses its group's palette.
+**
+** Clustering starts from groups seeded by the tile mean colors (farthest
+** point seeding), then iterates: a palette is generated for each group from
+** the pixels of its tiles (depth reduction and the main quantizer pass), and
+** every tile is assigned to the group whose palette maps it with the least
+** error, until no tile moves.
+**
+** Also provides duplicate tile elimination for the palette application:
+** the unique tiles of an image are collected into an atlas, which is
+** processed instead of the image (dithering each tile on its own), then the
+** results are copied to every occurrence of the tiles.
+*/
+
+
+#ifndef TILEPAL_H
+#define TILEPAL_H
+
+#include "types.h"
+
+
+
+/* Maximal count of palette groups */
+#define TILEPAL_GMAX 64U
+
+/* Maximal count of tiles in an image */
+#define TILEPAL_TMAX 65536U
+
+
+
+/* Returns the count of tiles covering an image (tiles on the right and the
+** bottom edge may be partial). The tiles are in row-major order. */
+auint tilepal_cnt(auint wd, auint hg, auint tw, auint th);
+
+
+/* Generates the palettes of gcnt tile groups (at most cols colors of pdep
+** depth each) for the image plane buf, and the group of each tile in map.
+** The wrk plane (same size as buf) and pal (MQUANT_COLS colors) are used as
+** work area, drc is the depth reduction target. Groups receiving no tiles
+** get an empty palette. Fully transparent pixels are not considered. */
+void tilepal(auint const* buf, auint* wrk, auint wd, auint hg, auint tw, auint th,
+             iquant_pal_t* pal, auint drc, auint cols, auint pdep,
+             iquant_pal_t* gpal, auint gcnt, uint8* map);
+
+
+/* Applies the group palettes on the image plane buf flat, into wrk, each
+** tile by its group's palette. The index of each pixel's color within its
+** palette is written into idx (fully transparent pixels get zero). */
+void tilepal_apply(auint const* buf, auint* wrk, uint8* idx, auint wd, auint hg, auint tw, auint th,
+                   iquant_pal_t const* gpal, uint8 const* map);
+
+
+/* Collects the unique tiles of the image plane buf into the atlas abuf, and
+** the index of every tile's unique tile into uni. Partial tiles on the
+** edges are padded by repeating their last column and row. Returns the
+** count of unique tiles. */
+auint tilepal_dedup(auint const* buf, auint wd, auint hg, auint tw, auint th,
+                    auint* abuf, auint* uni);
+
+
+/* Copies the processed unique tiles of the atlas awrk to every occurrence
+** of them in the image plane wrk. */
+void tilepal_scatter(auint const* awrk, auint* wrk, auint wd, auint hg, auint tw, auint th,
+                     auint const* uni);
+
+
+#endif
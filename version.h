@@ -22,4 +22,4 @@
 */
 
 
-#define IQUANT_VERSION "0.3.1"
+#define IQUANT_VERSION "0.3.2"